@@ -0,0 +1,335 @@
+// Lexer microbenchmark.
+//
+//   make bench && ./bench/lex_bench [MiB] [max threads]
+//
+// Generates an identifier-heavy corpus in memory and reports lexer
+// throughput at every scanner level the CPU supports, parallel lexing at
+// 2, 4, ... threads (checked against lex()), relexing after random edits
+// (also checked against lex()) and the cost of relexing a small edit, plus
+// keyword classification against a linear strcmp table.
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "lexer.h"
+#include "arena.h"
+#include "scan.h"
+
+INSTANTIATE(char, char, ARRAY_TEMPLATE)
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *words[] = {
+    "fn", "int", "return", "value", "count", "mut", "struct", "node_next",
+    "if", "else", "while", "buffer", "for", "index", "continue", "break",
+    "true", "false", "null", "union", "module", "include", "type", "string",
+    "parent_scope", "symbol", "left", "right", "accumulator", "enum",
+    "42", "0x7fff_ffff", "1_000_000", "3.25e-3"
+};
+
+static void push_str(char_array *out, char *s) {
+    while (*s) char_array_push(out, *s++);
+}
+
+static String make_corpus(size_t target) {
+    char_array out = char_array_init();
+    size_t n_words = sizeof(words) / sizeof(words[0]);
+    unsigned seed = 1;
+
+    for (size_t line = 0; out.len < target; line++) {
+        push_str(&out, "        ");
+        if (line % 4 == 0) {
+            push_str(&out, "// generated table entries follow, keep in sync with the schema\n        ");
+        }
+        if (line % 8 == 6) {
+            // a literal spanning a newline, so chunk splitting has something to avoid
+            push_str(&out, "\"see \\\"schema\\\" // not a comment\n        for details\" '\\n';\n        ");
+        }
+        for (size_t i = 0; i < 12; i++) {
+            seed = seed * 1103515245 + 12345;
+            push_str(&out, words[(seed >> 16) % n_words]);
+            char_array_push(&out, (i % 4 == 3) ? ';' : ' ');
+        }
+        char_array_push(&out, '\n');
+    }
+    size_t length = out.len;
+    for (size_t i = 0; i < SOURCE_PADDING; i++) char_array_push(&out, '\0');
+
+    return (String){ .data = out.data, .length = length };
+}
+
+static char *keyword_table[] = {
+    "module", "include", "fn", "return", "struct", "union", "enum", "type", "mut",
+    "if", "else", "for", "while", "break", "continue", "true", "false", "null"
+};
+
+// The old decode_ident: NUL-terminate and strcmp against every keyword.
+static int linear_lookup(const char *text, size_t length) {
+    char buf[64];
+    memcpy(buf, text, length);
+    buf[length] = '\0';
+    for (size_t i = 0; i < sizeof(keyword_table) / sizeof(keyword_table[0]); i++) {
+        if (strcmp(buf, keyword_table[i]) == 0) return (int)i;
+    }
+    return -1;
+}
+
+static void bench_keywords(size_t iters) {
+    size_t n_words = sizeof(words) / sizeof(words[0]);
+    size_t lens[sizeof(words) / sizeof(words[0])];
+    for (size_t i = 0; i < n_words; i++) lens[i] = strlen(words[i]);
+
+    volatile long sink = 0;
+
+    double t0 = now();
+    for (size_t i = 0; i < iters; i++) {
+        size_t w = i % n_words;
+        sink += linear_lookup(words[w], lens[w]);
+    }
+    double linear = now() - t0;
+
+    t0 = now();
+    for (size_t i = 0; i < iters; i++) {
+        size_t w = i % n_words;
+        sink += keyword_lookup(words[w], lens[w]);
+    }
+    double direct = now() - t0;
+
+    printf("keywords: linear %.2f ns/ident, switch %.2f ns/ident (%.1fx)\n",
+           linear / iters * 1e9, direct / iters * 1e9, linear / direct);
+}
+
+static void bench_lex(String corpus, int runs, const char *label) {
+    double best = 1e30;
+    size_t n_tokens = 0;
+    size_t token_bytes = 0;
+
+    for (int r = 0; r < runs; r++) {
+        Lexer lexer = {
+            .arena = arena_create(),
+            .source = {
+                .path = string_make("<bench>"),
+                .contents = corpus,
+                .index = 0,
+            },
+        };
+
+        double t0 = now();
+        token_array tokens = lex(&lexer);
+        double dt = now() - t0;
+
+        if (dt < best) best = dt;
+        n_tokens = tokens.len;
+        token_bytes = tokens.len * (sizeof(*tokens.kinds) + sizeof(*tokens.starts) + sizeof(*tokens.aux))
+                    + tokens.payloads.len * sizeof(TokenPayload);
+
+        token_array_free(&tokens);
+        arena_destroy(lexer.arena);
+    }
+
+    double mib = corpus.length / (1024.0 * 1024.0);
+    printf("lex (%s): %.2f MiB, %zu tokens, %.1f MiB/s, %.1f ns/token\n",
+           label, mib, n_tokens, mib / best, best / n_tokens * 1e9);
+    printf("    token storage %.1f B/token (%zu B as an array of Token)\n",
+           (double)token_bytes / n_tokens, sizeof(Token));
+}
+
+static bool same_tokens(token_array *a, token_array *b) {
+    return a->len == b->len
+        && memcmp(a->kinds, b->kinds, a->len * sizeof(*a->kinds)) == 0
+        && memcmp(a->starts, b->starts, a->len * sizeof(*a->starts)) == 0
+        && memcmp(a->aux, b->aux, a->len * sizeof(*a->aux)) == 0;
+}
+
+static void bench_lex_parallel(String corpus, int runs, size_t threads) {
+    Lexer lexer = {
+        .arena = arena_create(),
+        .source = { .path = string_make("<bench>"), .contents = corpus },
+    };
+    token_array expected = lex(&lexer);
+
+    double best = 1e30;
+    bool same = true;
+    for (int r = 0; r < runs; r++) {
+        double t0 = now();
+        token_array tokens = lex_parallel(&lexer, threads);
+        double dt = now() - t0;
+
+        if (dt < best) best = dt;
+        same = same && same_tokens(&tokens, &expected);
+        token_array_free(&tokens);
+    }
+
+    double mib = corpus.length / (1024.0 * 1024.0);
+    printf("lex_parallel (%zu threads): %.1f MiB/s, %.1f ns/token%s\n",
+           threads, mib / best, best / expected.len * 1e9, same ? "" : "  MISMATCH");
+
+    token_array_free(&expected);
+    arena_destroy(lexer.arena);
+}
+
+static bool same_token(Token a, Token b) {
+    if (a.type != b.type || a.span.start != b.span.start || a.span.length != b.span.length) return false;
+    switch (a.type) {
+        case TOKENTYPE_IDENT: return a.atom == b.atom;
+        case TOKENTYPE_INT_LIT: return a.number._int == b.number._int;
+        case TOKENTYPE_FLOAT_LIT: return a.number._float == b.number._float;
+        case TOKENTYPE_STR_LIT:
+        case TOKENTYPE_CHAR_LIT: return string_eq(a.value.value, b.value.value);
+        default: return true;
+    }
+}
+
+// Token by token, since payload indices differ once relex() has appended
+// to the payloads
+static bool same_stream(token_array *a, token_array *b) {
+    if (a->len != b->len) return false;
+    for (size_t i = 0; i < a->len; i++) {
+        if (!same_token(token_array_at(a, i), token_array_at(b, i))) return false;
+    }
+    return true;
+}
+
+// lex(), but false instead of exiting on a lexer error. The tokens are
+// collected outside the frame the error unwinds, so they can be freed.
+static token_array checked;
+
+static bool lex_checked(Lexer *lexer, token_array *out) {
+    jmp_buf here;
+    lexer->recover = &here;
+    if (setjmp(here) != 0) {
+        lexer->recover = NULL;
+        free(lexer->error);
+        token_array_free(&checked);
+        return false;
+    }
+
+    checked = token_array_init(lexer->source.contents.data);
+    for (Token t = lex_next(lexer); t.type != TOKENTYPE_EOF; t = lex_next(lexer)) {
+        token_array_push(&checked, t);
+    }
+    lexer->recover = NULL;
+    lexer->source.index = 0;
+    *out = checked;
+    return true;
+}
+
+// Makes random small edits near the start of the corpus, built from the
+// characters that decide where numbers, comments and strings end, and
+// checks that relex() leaves the same tokens as lexing the result afresh.
+// Edits that would not lex at all are skipped.
+static void check_relex(String corpus, int edits) {
+    static const char alphabet[] = "0123456789..ee++--//\n\n  _;x\"";
+    size_t length = corpus.length < 16 * 1024 ? corpus.length : 16 * 1024;
+    while (length > 0 && corpus.data[length - 1] != '\n') length--;
+
+    char *copy = malloc(length + SOURCE_PADDING);
+    memcpy(copy, corpus.data, length);
+    memset(copy + length, 0, SOURCE_PADDING);
+
+    Lexer lexer = {
+        .arena = arena_create(),
+        .source = { .path = string_make("<bench>"), .contents = { .data = copy, .length = length } },
+    };
+    token_array tokens = lex(&lexer);
+
+    unsigned seed = 7;
+    int applied = 0, failed = -1;
+    for (int i = 0; i < edits && failed < 0; i++) {
+        size_t n = lexer.source.contents.length;
+        seed = seed * 1103515245 + 12345;
+        size_t start = (seed >> 8) % (n + 1);
+        seed = seed * 1103515245 + 12345;
+        size_t end = start + (seed >> 8) % 4;
+        if (end > n) end = n;
+
+        char typed[4];
+        seed = seed * 1103515245 + 12345;
+        String text = { .data = typed, .length = (seed >> 8) % 4 };
+        for (size_t j = 0; j < text.length; j++) {
+            seed = seed * 1103515245 + 12345;
+            typed[j] = alphabet[(seed >> 8) % (sizeof(alphabet) - 1)];
+        }
+
+        Lexer fresh = { .arena = lexer.arena, .source = source_edit(&lexer.source, start, end, text) };
+        token_array expected;
+        if (lex_checked(&fresh, &expected)) {
+            relex(&lexer, &tokens, start, end, text);
+            if (!same_stream(&tokens, &expected)) failed = i;
+            token_array_free(&expected);
+            applied++;
+        }
+        source_close(&fresh.source);
+    }
+
+    if (failed >= 0) printf("relex check: MISMATCH at edit %d\n", failed);
+    else printf("relex check: %d random edits, tokens match lex()\n", applied);
+
+    token_array_free(&tokens);
+    source_close(&lexer.source);
+    arena_destroy(lexer.arena);
+}
+
+// Alternately types and deletes an identifier in the middle of the corpus
+static void bench_relex(String corpus, int edits) {
+    char *copy = malloc(corpus.length + SOURCE_PADDING);
+    memcpy(copy, corpus.data, corpus.length + SOURCE_PADDING);
+
+    Lexer lexer = {
+        .arena = arena_create(),
+        .source = { .path = string_make("<bench>"), .contents = { .data = copy, .length = corpus.length } },
+    };
+    token_array tokens = lex(&lexer);
+
+    size_t at = corpus.length / 2;
+    while (corpus.data[at] != '\n') at++;
+    String typed = string_make(" typed");
+
+    size_t relexed = 0;
+    double t0 = now();
+    for (int i = 0; i < edits; i++) {
+        TokenEdit e = (i % 2 == 0)
+            ? relex(&lexer, &tokens, at, at, typed)
+            : relex(&lexer, &tokens, at, at + typed.length, (String){0});
+        relexed += e.inserted;
+    }
+    double dt = now() - t0;
+
+    printf("relex: %.1f us/edit, %.1f tokens relexed per edit\n",
+           dt / edits * 1e6, (double)relexed / edits);
+
+    token_array_free(&tokens);
+    source_close(&lexer.source);
+    arena_destroy(lexer.arena);
+}
+
+int main(int argc, char **argv) {
+    size_t mib = argc > 1 ? strtoul(argv[1], NULL, 10) : 8;
+
+    String corpus = make_corpus(mib * 1024 * 1024);
+
+    bench_keywords(20 * 1000 * 1000);
+    for (ScanLevel level = SCAN_SCALAR; level <= SCAN_AVX2; level++) {
+        if (scan_use(level) != level) break;
+        bench_lex(corpus, 5, scan_level_name(level));
+    }
+    scan_use(SCAN_SCALAR);
+
+    check_relex(corpus, 20000);
+    bench_relex(corpus, 200);
+
+    size_t max_threads = argc > 2 ? strtoul(argv[2], NULL, 10) : (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+    for (size_t threads = 2; threads <= max_threads; threads *= 2) {
+        bench_lex_parallel(corpus, 5, threads);
+    }
+
+    free(corpus.data);
+    return 0;
+}
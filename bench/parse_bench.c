@@ -0,0 +1,216 @@
+// Parser microbenchmark.
+//
+//   make bench && ./bench/parse_bench [MiB] [max threads]
+//
+// Generates a module of statement-heavy functions in memory and reports
+// parse throughput, both streaming tokens from the lexer and reading a
+// pre-lexed token_array (whose lexing is not timed), with function bodies
+// skipped as signature-only tools do, then parallel
+// declaration parsing at 2, 4, ... threads (checked against parse_module()),
+// and the size of the compact AST next to the pointer AST it was built from.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "lexer.h"
+#include "parser.h"
+#include "arena.h"
+
+INSTANTIATE(char, char, ARRAY_TEMPLATE)
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void push_str(char_array *out, char *s) {
+    while (*s) char_array_push(out, *s++);
+}
+
+// Identifiers cannot contain digits, so functions are numbered in base 26
+static void push_name(char_array *out, size_t n) {
+    do {
+        char_array_push(out, 'a' + n % 26);
+        n /= 26;
+    } while (n);
+}
+
+static String make_corpus(size_t target) {
+    char_array out = char_array_init();
+    push_str(&out, "module bench;\n\ninclude std::io;\n\n");
+
+    for (size_t i = 0; out.len < target; i++) {
+        push_str(&out, "@inline\nfn int mut* func_");
+        push_name(&out, i);
+        push_str(&out,
+            "(int mut* values, uint count, char[16] name) {\n"
+            "    int total = 0x10;\n"
+            "    mut int index = count - 1;\n"
+            "    for (int i = 0; i < count; i = i + 1) {\n"
+            "        total = total + values[i] * 3 - (index << 2);\n"
+            "    }\n"
+            "    while (index > 0 && total != 1_000) {\n"
+            "        index = index - 1;\n"
+            "        io::println(name, \"index\", index % 7);\n"
+            "    }\n"
+            "    if (total >= 42) {\n"
+            "        return values.next;\n"
+            "    } else {\n"
+            "        total = -total;\n"
+            "    }\n"
+            "    return &values[total];\n"
+            "}\n\n");
+    }
+
+    size_t length = out.len;
+    for (size_t i = 0; i < SOURCE_PADDING; i++) char_array_push(&out, '\0');
+
+    return (String){ .data = out.data, .length = length };
+}
+
+typedef enum {
+    PARSE_STREAMING,
+    PARSE_PRE_LEXED,
+    PARSE_SIGNATURES,   // pre-lexed, function bodies left unparsed
+} ParseMode;
+
+static const char *mode_names[] = {
+    [PARSE_STREAMING] = "streaming",
+    [PARSE_PRE_LEXED] = "pre-lexed",
+    [PARSE_SIGNATURES] = "signatures only",
+};
+
+static void bench_parse(String corpus, int runs, ParseMode mode) {
+    double best = 1e30;
+    size_t n_tokens = 0;
+    size_t n_decls = 0;
+
+    for (int r = 0; r < runs; r++) {
+        Lexer lexer = {
+            .arena = arena_create(),
+            .source = {
+                .path = string_make("<bench>"),
+                .contents = corpus,
+                .index = 0,
+            },
+        };
+
+        Parser parser = { .arena = lexer.arena };
+        if (mode == PARSE_STREAMING) {
+            parser.lexer = &lexer;
+        } else {
+            parser.tokens = lex(&lexer);
+        }
+        if (mode == PARSE_SIGNATURES) {
+            parser.lazy_bodies = &parser.tokens;
+        }
+
+        double t0 = now();
+        Module *module = parse_module(&parser);
+        double dt = now() - t0;
+
+        if (dt < best) best = dt;
+        n_tokens = parser.index;
+        n_decls = module->decls.len;
+
+        if (mode != PARSE_STREAMING) token_array_free(&parser.tokens);
+        arena_destroy(lexer.arena);
+    }
+
+    double mib = corpus.length / (1024.0 * 1024.0);
+    printf("parse (%s): %.2f MiB, %zu decls, %zu tokens, %.1f MiB/s, %.1f ns/token\n",
+           mode_names[mode], mib, n_decls, n_tokens, mib / best, best / n_tokens * 1e9);
+}
+
+// Parses the same corpus with parse_module() and parse_module_parallel()
+// and checks both produced the same declarations
+static void bench_parse_parallel(String corpus, int runs, size_t threads) {
+    Lexer lexer = {
+        .arena = arena_create(),
+        .source = { .path = string_make("<bench>"), .contents = corpus },
+    };
+    token_array tokens = lex(&lexer);
+
+    Parser expected_parser = { .arena = lexer.arena, .tokens = tokens };
+    Module *expected = parse_module(&expected_parser);
+
+    double best = 1e30;
+    bool same = true;
+    for (int r = 0; r < runs; r++) {
+        Parser parser = { .arena = arena_create(), .tokens = tokens };
+
+        double t0 = now();
+        Module *module = parse_module_parallel(&parser, threads);
+        double dt = now() - t0;
+
+        if (dt < best) best = dt;
+        same = same && module->decls.len == expected->decls.len;
+        for (size_t i = 0; same && i < module->decls.len; i++) {
+            same = module->decls.data[i]->token.span.start == expected->decls.data[i]->token.span.start
+                && module->decls.data[i]->type == expected->decls.data[i]->type;
+        }
+        arena_destroy(parser.arena);
+    }
+
+    double mib = corpus.length / (1024.0 * 1024.0);
+    printf("parse_module_parallel (%zu threads): %.1f MiB/s, %.1f ns/token%s\n",
+           threads, mib / best, best / tokens.len * 1e9, same ? "" : "  MISMATCH");
+
+    token_array_free(&tokens);
+    arena_destroy(lexer.arena);
+}
+
+static void bench_compact(String corpus, int runs) {
+    Lexer lexer = {
+        .arena = arena_create(),
+        .source = { .path = string_make("<bench>"), .contents = corpus },
+    };
+    Parser parser = { .arena = arena_create(), .tokens = lex(&lexer) };
+    Module *module = parse_module(&parser);
+    size_t pointer_bytes = parser.arena->used;
+
+    double best = 1e30;
+    size_t compact_bytes = 0;
+    size_t nodes = 0;
+    for (int r = 0; r < runs; r++) {
+        double t0 = now();
+        CompactAst ast = ast_compact(module);
+        double dt = now() - t0;
+
+        if (dt < best) best = dt;
+        compact_bytes = compact_size(&ast);
+        nodes = ast.exprs.len + ast.stmts.len + ast.types.len + ast.vars.len;
+        compact_free(&ast);
+    }
+
+    printf("ast_compact: %zu nodes in %.1f ms, pointer AST %.1f MiB, compact %.1f MiB (%.1fx smaller)\n",
+           nodes, best * 1e3, pointer_bytes / (1024.0 * 1024.0), compact_bytes / (1024.0 * 1024.0),
+           (double)pointer_bytes / compact_bytes);
+
+    token_array_free(&parser.tokens);
+    arena_destroy(parser.arena);
+    arena_destroy(lexer.arena);
+}
+
+int main(int argc, char **argv) {
+    size_t mib = argc > 1 ? strtoul(argv[1], NULL, 10) : 8;
+
+    String corpus = make_corpus(mib * 1024 * 1024);
+
+    bench_parse(corpus, 5, PARSE_PRE_LEXED);
+    bench_parse(corpus, 5, PARSE_STREAMING);
+    bench_parse(corpus, 5, PARSE_SIGNATURES);
+
+    size_t max_threads = argc > 2 ? strtoul(argv[2], NULL, 10) : (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+    for (size_t threads = 2; threads <= max_threads; threads *= 2) {
+        bench_parse_parallel(corpus, 5, threads);
+    }
+
+    bench_compact(corpus, 5);
+
+    free(corpus.data);
+    return 0;
+}
@@ -1,72 +1,346 @@
 #include "arena.h"
+#include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
-#define BLOCK_SIZE (1024 * 1024)
+bool mem_stats_on;
+static MemPhase mem_current;
+static atomic_size_t mem_held;      // by arena blocks and heap arrays
+
+static struct {
+    atomic_size_t requested;
+    atomic_size_t wasted;           // left over at the end of arena blocks
+    atomic_size_t blocks;
+    atomic_size_t reallocs;
+    atomic_size_t peak;             // of mem_held
+} mem_stats[MEM_PHASE_COUNT];
+
+static const char *mem_phase_names[MEM_PHASE_COUNT] = {
+    [MEM_OTHER] = "other",
+    [MEM_LEX] = "lex",
+    [MEM_PARSE] = "parse",
+    [MEM_SEMA] = "sema",
+};
+
+void mem_stats_enable(void) {
+    mem_stats_on = true;
+}
+
+void mem_phase(MemPhase phase) {
+    mem_current = phase;
+    atomic_store(&mem_stats[phase].peak, atomic_load(&mem_held));
+}
+
+static void mem_add(atomic_size_t *counter, size_t n) {
+    atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+static void mem_hold(size_t add, size_t remove) {
+    size_t held = atomic_fetch_add_explicit(&mem_held, add - remove, memory_order_relaxed) + add - remove;
+    atomic_size_t *peak = &mem_stats[mem_current].peak;
+    size_t seen = atomic_load_explicit(peak, memory_order_relaxed);
+    while (held > seen && !atomic_compare_exchange_weak(peak, &seen, held));
+}
+
+void mem_count_heap(size_t old_bytes, size_t new_bytes) {
+    if (new_bytes > old_bytes) mem_add(&mem_stats[mem_current].requested, new_bytes - old_bytes);
+    if (old_bytes && new_bytes) mem_add(&mem_stats[mem_current].reallocs, 1);
+    mem_hold(new_bytes, old_bytes);
+}
+
+void mem_stats_print(void) {
+    double mib = 1024.0 * 1024.0;
+    fprintf(stderr, "%-8s %14s %14s %8s %10s %14s\n",
+            "phase", "requested", "wasted", "blocks", "reallocs", "peak");
+    for (MemPhase p = 0; p < MEM_PHASE_COUNT; p++) {
+        fprintf(stderr, "%-8s %10.2f MiB %10.2f MiB %8zu %10zu %10.2f MiB\n",
+                mem_phase_names[p],
+                atomic_load(&mem_stats[p].requested) / mib,
+                atomic_load(&mem_stats[p].wasted) / mib,
+                atomic_load(&mem_stats[p].blocks),
+                atomic_load(&mem_stats[p].reallocs),
+                atomic_load(&mem_stats[p].peak) / mib);
+    }
+}
+
+static void *align_up(void *p, size_t align) {
+    return (void*)(((uintptr_t)p + align - 1) & ~(uintptr_t)(align - 1));
+}
+
+// Adds a block of `size` bytes; as the new current block, or slotted in just
+// before the current one
+static void *push_block(Arena *a, size_t size, bool current) {
+    void *block = malloc(size);
+    void **blocks = realloc(a->blocks, (a->block_count + 1) * sizeof(void*));
+    if (!block || !blocks) {
+        fprintf(stderr, "arena: failed to allocate a %zu byte block\n", size);
+        exit(1);
+    }
+    a->blocks = blocks;
+    if (mem_stats_on) {
+        mem_add(&mem_stats[mem_current].blocks, 1);
+        mem_hold(malloc_usable_size(block), 0);
+        if (a->block_count) mem_add(&mem_stats[mem_current].reallocs, 1);
+        if (current && a->block_count) {
+            mem_add(&mem_stats[mem_current].wasted, a->block_size - a->current_index);
+        }
+    }
+
+    if (current) {
+        a->blocks[a->block_count] = block;
+        a->block_size = size;
+        a->current_index = 0;
+    } else {
+        a->blocks[a->block_count] = a->blocks[a->block_count - 1];
+        a->blocks[a->block_count - 1] = block;
+    }
+    a->block_count++;
+    return block;
+}
 
 Arena *arena_create() {
     Arena *a = malloc(sizeof(Arena));
     if (!a) {
         exit(1);
     }
-    a->block_size = BLOCK_SIZE;
-    a->block_count = 1;
-    a->blocks = malloc(sizeof(void*));
-    if (!a->blocks) {
-        free(a);
-        exit(1);
-    }
-    a->blocks[0] = malloc(a->block_size);
-    if (!a->blocks[0]) {
-        free(a->blocks);
-        free(a);
+    *a = (Arena){0};
+    push_block(a, ARENA_FIRST_BLOCK, true);
+    return a;
+}
+
+static size_t page_size(void) {
+    static size_t size;
+    if (!size) size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+static size_t page_up(size_t n) {
+    return (n + page_size() - 1) & ~(page_size() - 1);
+}
+
+Arena *arena_create_reserved(size_t reserve) {
+    reserve = page_up(reserve);
+    char *base = mmap(NULL, reserve, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) return arena_create();
+
+    size_t first = ARENA_FIRST_BLOCK < reserve ? ARENA_FIRST_BLOCK : reserve;
+    void **blocks = malloc(sizeof(void*));
+    Arena *a = malloc(sizeof(Arena));
+    if (!a || !blocks || mprotect(base, first, PROT_READ | PROT_WRITE) != 0) {
+        fprintf(stderr, "arena: failed to commit a %zu byte reservation\n", reserve);
         exit(1);
     }
-    a->current_index = 0;
+
+    blocks[0] = base;
+    if (mem_stats_on) mem_hold(first, 0);
+    *a = (Arena){
+        .blocks = blocks,
+        .block_count = 1,
+        .block_size = first,
+        .reserve = base,
+        .reserve_size = reserve,
+        .committed = first,
+    };
     return a;
 }
 
-void *arena_alloc(Arena *a, size_t size) {
-    if (size > a->block_size - a->current_index) {
-        a->block_count++;
-        a->blocks = realloc(a->blocks, a->block_count * sizeof(void*));
-        if (!a->blocks) {
-            exit(1);
-        }
-        a->blocks[a->block_count - 1] = malloc(a->block_size);
-        if (!a->blocks[a->block_count - 1]) {
-            exit(1);
-        }
-        a->current_index = 0;
+// Commits enough of the reserved range after the current index for `need`
+// more bytes, in ARENA_FIRST_BLOCK steps so what is committed stays close to
+// what is used; false once the range runs out
+static bool commit(Arena *a, size_t need) {
+    if (a->blocks[a->block_count - 1] != a->reserve) return false;
+    if (need > a->reserve_size - a->current_index) return false;
+
+    size_t step = ARENA_FIRST_BLOCK;
+    size_t want = (a->current_index + need + step - 1) / step * step;
+    if (want > a->reserve_size) want = a->reserve_size;
+
+    if (mprotect(a->reserve + a->committed, want - a->committed, PROT_READ | PROT_WRITE) != 0) {
+        return false;
     }
+    if (mem_stats_on) mem_hold(want - a->committed, 0);
+    a->block_size = a->committed = want;
+    return true;
+}
 
-    void *data = (char*)a->blocks[a->block_count - 1] + a->current_index;
-    a->current_index += size;
-    return data;
+static void *bump(Arena *a, size_t size, size_t align) {
+    char *block = a->blocks[a->block_count - 1];
+    char *at = align_up(block + a->current_index, align);
+    size_t offset = at - block;
+
+    if (offset <= a->block_size && size <= a->block_size - offset) {
+        a->used += offset + size - a->current_index;
+        a->current_index = offset + size;
+        return at;
+    }
+
+    if (size > SIZE_MAX - align) {
+        fprintf(stderr, "arena: allocation of %zu bytes is too large\n", size);
+        exit(1);
+    }
+    size_t need = size + align - 1;
+
+    if (a->reserve && commit(a, need)) {
+        return bump(a, size, align);
+    }
+
+    if (need > a->block_size / 4) {
+        a->used += need;
+        return align_up(push_block(a, need, false), align);
+    }
+
+    size_t next = a->block_size < ARENA_MAX_BLOCK ? a->block_size * 2 : a->block_size;
+    push_block(a, next, true);
+    return bump(a, size, align);
 }
 
-void *arena_calloc(Arena *a, size_t size) {
-    void *data = arena_alloc(a, size);
+void *arena_alloc_aligned(Arena *a, size_t size, size_t align) {
+    if (mem_stats_on) mem_add(&mem_stats[mem_current].requested, size);
+    return bump(a, size, align);
+}
+
+void *arena_calloc_aligned(Arena *a, size_t size, size_t align) {
+    void *data = arena_alloc_aligned(a, size, align);
     memset(data, 0, size);
     return data;
 }
 
+void *arena_alloc(Arena *a, size_t size) {
+    return arena_alloc_aligned(a, size, ARENA_ALIGN);
+}
+
+void *arena_calloc(Arena *a, size_t size) {
+    return arena_calloc_aligned(a, size, ARENA_ALIGN);
+}
 
+static void free_block(Arena *a, void *block) {
+    if (block == a->reserve) {
+        if (mem_stats_on) mem_hold(0, a->committed);
+        munmap(a->reserve, a->reserve_size);
+    } else {
+        if (mem_stats_on) mem_hold(0, malloc_usable_size(block));
+        free(block);
+    }
+}
+
+// Makes the reserved range current again from `index` on and drops its
+// pages past that; they read back as zeroes if used again
+static void release_pages(Arena *a, size_t index) {
+    a->block_size = a->committed;
+    size_t from = page_up(index);
+    if (from < a->committed) {
+        madvise(a->reserve + from, a->committed - from, MADV_DONTNEED);
+    }
+}
+
+// Keeps one block, the reserved range if there is one, and frees the rest
 void arena_clear(Arena *a) {
-    // Not implemented, since we don't reuse
+    void *keep = a->reserve ? a->reserve : a->blocks[a->block_count - 1];
+    for (size_t i = 0; i < a->block_count; i++) {
+        if (a->blocks[i] != keep) free_block(a, a->blocks[i]);
+    }
+    a->blocks[0] = keep;
+    a->block_count = 1;
+    a->current_index = 0;
+    a->used = 0;
+    if (a->reserve) release_pages(a, 0);
+}
+
+ArenaMark arena_mark(Arena *a) {
+    return (ArenaMark){
+        .block = a->blocks[a->block_count - 1],
+        .block_count = a->block_count,
+        .block_size = a->block_size,
+        .current_index = a->current_index,
+        .used = a->used,
+    };
+}
+
+// Blocks before the marked current block never move, since new blocks go
+// either last or just before the current one; everything from its old slot
+// on was added since, apart from the marked block itself
+void arena_reset_to(Arena *a, ArenaMark mark) {
+    for (size_t i = mark.block_count - 1; i < a->block_count; i++) {
+        if (a->blocks[i] != mark.block) free_block(a, a->blocks[i]);
+    }
+    a->blocks[mark.block_count - 1] = mark.block;
+    a->block_count = mark.block_count;
+    a->current_index = mark.current_index;
+    a->used = mark.used;
+
+    // The reserved range stays committed as far as it has grown. Pages just
+    // past the mark are left resident, so a reset per function costs no
+    // syscall unless that function used a lot of memory.
+    if (a->reserve && mark.block == a->reserve) {
+        release_pages(a, mark.current_index + ARENA_RESET_KEEP);
+    } else {
+        a->block_size = mark.block_size;
+    }
+}
+
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+static _Thread_local Arena *scratch;
+
+static void scratch_destroy(void *a) {
+    arena_destroy(a);
+}
+
+static void scratch_key_create(void) {
+    pthread_key_create(&scratch_key, scratch_destroy);
+}
+
+Arena *arena_scratch(void) {
+    if (!scratch) {
+        pthread_once(&scratch_once, scratch_key_create);
+        scratch = arena_create_reserved(ARENA_RESERVE);
+        pthread_setspecific(scratch_key, scratch);
+    }
+    return scratch;
 }
 
 char *arena_strdup(Arena *a, char *s) {
     size_t n = strlen(s) + 1;
-    char *dst = arena_alloc(a, n);
+    char *dst = arena_new_array(a, char, n);
     memcpy(dst, s, n);
     return dst;
 }
 
+// Takes over other's blocks, so they live and die with a, and frees other.
+// a keeps allocating from its own current block. other can't be reserved.
+void arena_adopt(Arena *a, Arena *other) {
+    if (other->reserve) {
+        fprintf(stderr, "arena_adopt: can't adopt a reserved arena\n");
+        exit(1);
+    }
+    if (mem_stats_on) mem_add(&mem_stats[mem_current].reallocs, 1);
+
+    a->blocks = realloc(a->blocks, (a->block_count + other->block_count) * sizeof(void*));
+    if (!a->blocks) {
+        exit(1);
+    }
+
+    void *current = a->blocks[a->block_count - 1];
+    memcpy(&a->blocks[a->block_count - 1], other->blocks, other->block_count * sizeof(void*));
+    a->block_count += other->block_count;
+    a->blocks[a->block_count - 1] = current;
+    a->used += other->used;
+
+    free(other->blocks);
+    free(other);
+}
+
 void arena_destroy(Arena *a) {
     for (size_t i = 0; i < a->block_count; i++) {
-        free(a->blocks[i]);
+        free_block(a, a->blocks[i]);
     }
     free(a->blocks);
     free(a);
-}
\ No newline at end of file
+}
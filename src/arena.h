@@ -2,19 +2,94 @@
 #define ARENA_H
 
 #include <stddef.h>
+#include <stdbool.h>
+#include <stdalign.h>
 
+// Blocks start at ARENA_FIRST_BLOCK bytes and double up to ARENA_MAX_BLOCK.
+// A request bigger than a quarter of the current block gets a block of its
+// own, so the current one keeps serving small requests.
+#define ARENA_FIRST_BLOCK (1024 * 1024)
+#define ARENA_MAX_BLOCK (64 * 1024 * 1024)
+
+// What arena_alloc() aligns to, like malloc()
+#define ARENA_ALIGN alignof(max_align_t)
+
+// Address space a reserved arena asks for; only touched pages use memory
+#define ARENA_RESERVE ((size_t)64 << 30)
+
+// How far past a mark arena_reset_to() leaves a reserved arena's pages
+// resident; only what lies beyond goes back to the kernel
+#define ARENA_RESET_KEEP (4 * ARENA_FIRST_BLOCK)
+
+typedef struct {
+    void **blocks;          // the current block is always last
+    size_t block_count;
+    size_t block_size;      // of the current block
+    size_t current_index;   // bytes used in the current block
+    size_t used;            // bytes handed out, alignment padding included
+    char *reserve;          // start of the reserved range, or NULL
+    size_t reserve_size;
+    size_t committed;       // bytes of the reserved range that are usable
+} Arena;
+
+// A position in an arena to roll back to
 typedef struct {
-    void **blocks;
+    void *block;            // current when the mark was taken
     size_t block_count;
     size_t block_size;
     size_t current_index;
-} Arena;
+    size_t used;
+} ArenaMark;
 
 Arena *arena_create();
+// An arena that grows in place inside `reserve` bytes of address space,
+// committing pages as it goes, so its memory is one contiguous range.
+// Falls back to blocks if the range can't be reserved or runs out.
+Arena *arena_create_reserved(size_t reserve);
 void *arena_alloc(Arena *a, size_t size);
 void *arena_calloc(Arena *a, size_t size);
+// align must be a power of two
+void *arena_alloc_aligned(Arena *a, size_t size, size_t align);
+void *arena_calloc_aligned(Arena *a, size_t size, size_t align);
 void arena_clear(Arena *a);
 void arena_destroy(Arena *a);
+void arena_adopt(Arena *a, Arena *other);
 char *arena_strdup(Arena *a, char *s);
 
-#endif
\ No newline at end of file
+// arena_reset_to() releases everything allocated since the mark was taken;
+// marks must be reset in reverse order of taking them. A reserved arena keeps
+// its pages committed, and hands those more than ARENA_RESET_KEEP past the
+// mark back to the kernel with madvise().
+ArenaMark arena_mark(Arena *a);
+void arena_reset_to(Arena *a, ArenaMark mark);
+
+// This thread's arena for short-lived allocations, made on first use and
+// freed when the thread exits. Take a mark, allocate, and reset to the mark
+// before returning; nothing in it may outlive the caller.
+Arena *arena_scratch(void);
+
+// A zeroed T, and an uninitialised T[n], aligned for T
+#define arena_new(a, T) ((T*)arena_calloc_aligned((a), sizeof(T), alignof(T)))
+#define arena_new_array(a, T, n) ((T*)arena_alloc_aligned((a), sizeof(T) * (n), alignof(T)))
+
+// Allocation counters for --mem-stats, kept per compiler phase once
+// mem_stats_enable() is called; until then they cost a branch
+typedef enum {
+    MEM_OTHER,
+    MEM_LEX,
+    MEM_PARSE,
+    MEM_SEMA,
+    MEM_PHASE_COUNT
+} MemPhase;
+
+extern bool mem_stats_on;
+
+void mem_stats_enable(void);
+// Where allocations are counted from now on, for every thread
+void mem_phase(MemPhase phase);
+// A heap block growing from old_bytes to new_bytes, either of which is 0
+// when it is first allocated or freed
+void mem_count_heap(size_t old_bytes, size_t new_bytes);
+void mem_stats_print(void);
+
+#endif
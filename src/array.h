@@ -6,7 +6,23 @@
 #include <string.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <assert.h>
 #include "instantiate.h"
+#include "arena.h"
+
+// Using an array that was never initialised, or popping an empty one, exits
+// with a message. Building with -DARRAY_UNCHECKED turns these into asserts,
+// which -DNDEBUG then compiles out so hot loops carry no checks.
+#ifdef ARRAY_UNCHECKED
+#define ARRAY_CHECK(cond, msg) assert((cond) && msg)
+#else
+#define ARRAY_CHECK(cond, msg) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s\n", msg); \
+        exit(1); \
+    } \
+} while (0)
+#endif
 
 #define ARRAY_TEMPLATE(T, N) \
 typedef struct { \
@@ -14,8 +30,9 @@ typedef struct { \
     size_t len; \
     size_t cap; \
     bool alive; \
+    Arena *arena; \
 } N##_array; \
-static N##_array N##_array_empty = {}; \
+[[maybe_unused]] static N##_array N##_array_empty = {}; \
 static inline N##_array N##_array##_init(void) { \
     N##_array v = {}; \
     v.data = (T*)calloc(1, sizeof(T)); \
@@ -23,68 +40,212 @@ static inline N##_array N##_array##_init(void) { \
         fprintf(stderr, #N "_array_init: malloc failed\n"); \
         exit(1); \
     } \
+    if (mem_stats_on) mem_count_heap(0, sizeof(T)); \
     v.len = 0; \
     v.cap = 1; \
     v.alive = true; \
     return v; \
 } \
-static inline void N##_array##_push(N##_array *v, T item) { \
-    if (!v->alive) { \
-        fprintf(stderr, #N "_array_push: uninitialised array\n"); \
-        exit(1); \
-    } \
-    if (v->len == v->cap) { \
-        v->cap = v->cap ? v->cap * 2 : 8; \
-        v->data = (T*)realloc(v->data, v->cap * sizeof(T)); \
+/* Starts empty and grows inside `a`, so it is released with the arena and \
+   N_array_free() only forgets it. */ \
+static inline N##_array N##_array_init_in(Arena *a) { \
+    return (N##_array){ .alive = true, .arena = a }; \
+} \
+static inline void N##_array_grow(N##_array *v, size_t cap) { \
+    if (v->arena) { \
+        T *data = arena_new_array(v->arena, T, cap); \
+        if (v->len) memcpy(data, v->data, v->len * sizeof(T)); \
+        v->data = data; \
+    } else { \
+        v->data = (T*)realloc(v->data, cap * sizeof(T)); \
         if (!v->data) { \
-            fprintf(stderr, #N "_array_push: realloc failed\n"); \
+            fprintf(stderr, #N "_array_grow: realloc failed\n"); \
             exit(1); \
         } \
+        if (mem_stats_on) mem_count_heap(v->cap * sizeof(T), cap * sizeof(T)); \
+    } \
+    v->cap = cap; \
+} \
+static inline void N##_array##_push(N##_array *v, T item) { \
+    ARRAY_CHECK(v->alive, #N "_array_push: uninitialised array"); \
+    if (v->len == v->cap) { \
+        N##_array_grow(v, v->cap ? v->cap * 2 : (v->arena ? 4 : 8)); \
     } \
     v->data[v->len++] = item; \
 } \
+/* Makes room for `num` more items, at least doubling when it grows */ \
+static inline void N##_array_reserve(N##_array *v, size_t num) { \
+    ARRAY_CHECK(v->alive, #N "_array_reserve: uninitialised array"); \
+    if (num <= v->cap - v->len) return; \
+    size_t cap = v->cap ? v->cap * 2 : (v->arena ? 4 : 8); \
+    if (cap < v->len + num) cap = v->len + num; \
+    N##_array_grow(v, cap); \
+} \
+/* Copies in `num` items */ \
+static inline void N##_array_extend(N##_array *v, const T *items, size_t num) { \
+    N##_array_reserve(v, num); \
+    if (num) memcpy(v->data + v->len, items, num * sizeof(T)); \
+    v->len += num; \
+} \
+/* Pushes `num` copies of item */ \
 static inline void N##_array_append(N##_array *v, size_t num, T item) { \
-    if (!v->alive) { \
-        fprintf(stderr, #N "_array_append: uninitialised array\n"); \
-        exit(1); \
-    } \
-    for (size_t i = 0; i < num; i++) { \
-        N##_array_push(v, item); \
+    N##_array_reserve(v, num); \
+    T *out = v->data + v->len; \
+    if (sizeof(T) == 1) { \
+        memset(out, *(unsigned char*)&item, num); \
+    } else { \
+        for (size_t i = 0; i < num; i++) out[i] = item; \
     } \
+    v->len += num; \
+} \
+static inline T N##_array_pop(N##_array *v) { \
+    ARRAY_CHECK(v->alive && v->len, #N "_array_pop: empty array"); \
+    return v->data[--v->len]; \
+} \
+/* Removes item i by moving the last item into its place */ \
+static inline T N##_array_swap_remove(N##_array *v, size_t i) { \
+    ARRAY_CHECK(v->alive && i < v->len, #N "_array_swap_remove: index out of range"); \
+    T *data = v->data; \
+    T item = data[i]; \
+    data[i] = data[--v->len]; \
+    return item; \
 } \
 static inline void N##_array##_free(N##_array *v) { \
-    if (!v->alive) { \
-        fprintf(stderr, #N "_array_free: uninitialised array\n"); \
-        exit(1); \
+    ARRAY_CHECK(v->alive, #N "_array_free: uninitialised array"); \
+    if (!v->arena) { \
+        free(v->data); \
+        if (mem_stats_on) mem_count_heap(v->cap * sizeof(T), 0); \
     } \
-    free(v->data); \
+    v->data = NULL; \
     v->len = v->cap = 0; \
 } \
 static inline T N##_array##_at(N##_array *v, size_t len) { \
-    if (!v->alive) { \
-        fprintf(stderr, #N "_array_at: uninitialised array\n"); \
-        exit(1); \
-    } \
+    ARRAY_CHECK(v->alive, #N "_array_at: uninitialised array"); \
     return v->data[len >= v->len ? (v->cap - 1) : len]; \
 } \
 static inline void N##_array##_resize(N##_array *v, size_t elems) { \
-    if (!v->alive) { \
-        fprintf(stderr, #N "_array_resize: uninitialised array\n"); \
-        exit(1); \
-    } \
+    ARRAY_CHECK(v->alive, #N "_array_resize: uninitialised array"); \
     if (elems < v->cap) return; \
-    v->data = (T*)realloc(v->data, elems * sizeof(T)); \
-    if (!v->data) { \
-        fprintf(stderr, #N "_array_resize: realloc failed\n"); \
-        exit(1); \
-    } \
-    v->cap = elems; \
+    N##_array_grow(v, elems); \
 } \
 static inline void N##_array_clear(N##_array *v) { \
-    if (!v->alive) { \
-        fprintf(stderr, #N "_array_clear: uninitialised array\n"); \
-        exit(1); \
+    ARRAY_CHECK(v->alive, #N "_array_clear: uninitialised array"); \
+    v->len = 0; \
+} \
+
+// ARRAY_TEMPLATE for lists that are usually short: the first inline_cap items
+// live in the array itself, and only a longer list spills to the heap or its
+// arena. Arrays are copied by value, so reach the items through
+// N_array_data() and don't keep pointers to them across a copy.
+#define SMALL_ARRAY_TEMPLATE(T, N, inline_cap) \
+typedef struct { \
+    T *spilled;     /* NULL while the items fit inline */ \
+    size_t len; \
+    size_t cap; \
+    bool alive; \
+    Arena *arena; \
+    T inline_items[inline_cap]; \
+} N##_array; \
+[[maybe_unused]] static N##_array N##_array_empty = {}; \
+static inline N##_array N##_array_init(void) { \
+    return (N##_array){ .cap = inline_cap, .alive = true }; \
+} \
+static inline N##_array N##_array_init_in(Arena *a) { \
+    return (N##_array){ .cap = inline_cap, .alive = true, .arena = a }; \
+} \
+static inline T *N##_array_data(N##_array *v) { \
+    return v->spilled ? v->spilled : v->inline_items; \
+} \
+static inline void N##_array_grow(N##_array *v, size_t cap) { \
+    T *data; \
+    if (v->spilled && !v->arena) { \
+        data = (T*)realloc(v->spilled, cap * sizeof(T)); \
+        if (!data) { \
+            fprintf(stderr, #N "_array_grow: realloc failed\n"); \
+            exit(1); \
+        } \
+        if (mem_stats_on) mem_count_heap(v->cap * sizeof(T), cap * sizeof(T)); \
+    } else { \
+        if (v->arena) { \
+            data = arena_new_array(v->arena, T, cap); \
+        } else { \
+            data = (T*)malloc(cap * sizeof(T)); \
+            if (!data) { \
+                fprintf(stderr, #N "_array_grow: malloc failed\n"); \
+                exit(1); \
+            } \
+            if (mem_stats_on) mem_count_heap(0, cap * sizeof(T)); \
+        } \
+        if (v->len) memcpy(data, N##_array_data(v), v->len * sizeof(T)); \
     } \
+    v->spilled = data; \
+    v->cap = cap; \
+} \
+static inline void N##_array_push(N##_array *v, T item) { \
+    ARRAY_CHECK(v->alive, #N "_array_push: uninitialised array"); \
+    if (v->len == v->cap) { \
+        N##_array_grow(v, v->cap * 2); \
+    } \
+    N##_array_data(v)[v->len++] = item; \
+} \
+/* Makes room for `num` more items, at least doubling when it grows */ \
+static inline void N##_array_reserve(N##_array *v, size_t num) { \
+    ARRAY_CHECK(v->alive, #N "_array_reserve: uninitialised array"); \
+    if (num <= v->cap - v->len) return; \
+    size_t cap = v->cap * 2; \
+    if (cap < v->len + num) cap = v->len + num; \
+    N##_array_grow(v, cap); \
+} \
+/* Copies in `num` items */ \
+static inline void N##_array_extend(N##_array *v, const T *items, size_t num) { \
+    N##_array_reserve(v, num); \
+    if (num) memcpy(N##_array_data(v) + v->len, items, num * sizeof(T)); \
+    v->len += num; \
+} \
+/* Pushes `num` copies of item */ \
+static inline void N##_array_append(N##_array *v, size_t num, T item) { \
+    N##_array_reserve(v, num); \
+    T *out = N##_array_data(v) + v->len; \
+    if (sizeof(T) == 1) { \
+        memset(out, *(unsigned char*)&item, num); \
+    } else { \
+        for (size_t i = 0; i < num; i++) out[i] = item; \
+    } \
+    v->len += num; \
+} \
+static inline T N##_array_pop(N##_array *v) { \
+    ARRAY_CHECK(v->alive && v->len, #N "_array_pop: empty array"); \
+    return N##_array_data(v)[--v->len]; \
+} \
+/* Removes item i by moving the last item into its place */ \
+static inline T N##_array_swap_remove(N##_array *v, size_t i) { \
+    ARRAY_CHECK(v->alive && i < v->len, #N "_array_swap_remove: index out of range"); \
+    T *data = N##_array_data(v); \
+    T item = data[i]; \
+    data[i] = data[--v->len]; \
+    return item; \
+} \
+static inline void N##_array_free(N##_array *v) { \
+    ARRAY_CHECK(v->alive, #N "_array_free: uninitialised array"); \
+    if (v->spilled && !v->arena) { \
+        free(v->spilled); \
+        if (mem_stats_on) mem_count_heap(v->cap * sizeof(T), 0); \
+    } \
+    v->spilled = NULL; \
+    v->len = 0; \
+    v->cap = inline_cap; \
+} \
+static inline T N##_array_at(N##_array *v, size_t len) { \
+    ARRAY_CHECK(v->alive, #N "_array_at: uninitialised array"); \
+    return N##_array_data(v)[len >= v->len ? (v->cap - 1) : len]; \
+} \
+static inline void N##_array_resize(N##_array *v, size_t elems) { \
+    ARRAY_CHECK(v->alive, #N "_array_resize: uninitialised array"); \
+    if (elems < v->cap) return; \
+    N##_array_grow(v, elems); \
+} \
+static inline void N##_array_clear(N##_array *v) { \
+    ARRAY_CHECK(v->alive, #N "_array_clear: uninitialised array"); \
     v->len = 0; \
 } \
 
@@ -0,0 +1,895 @@
+#include <sys/mman.h>
+#include "ast.h"
+#include "parser.h"
+
+static uint32_t offset_of(Token *t) {
+    if (t->span.start > UINT32_MAX) {
+        fprintf(stderr, "ast_compact: source larger than 4 GiB\n");
+        exit(1);
+    }
+    return (uint32_t)t->span.start;
+}
+
+// Reserves `count` slots in ast->lists. Children are flattened into them
+// one by one, by index, since flattening a child may grow (move) the list.
+static NodeRange reserve_list(CompactAst *ast, size_t count) {
+    NodeRange range = { .start = ast->lists.len, .count = count };
+    node_array_append(&ast->lists, count, NODE_NONE);
+    return range;
+}
+
+static uint32_t push_number(CompactAst *ast, uint64_t bits) {
+    u64_array_push(&ast->numbers, bits);
+    return ast->numbers.len - 1;
+}
+
+static uint32_t push_string(CompactAst *ast, String s) {
+    string_array_push(&ast->strings, s);
+    return ast->strings.len - 1;
+}
+
+static NodeRange flat_atoms(CompactAst *ast, atom_array *atoms) {
+    NodeRange range = reserve_list(ast, atoms->len);
+    for (size_t i = 0; i < atoms->len; i++) {
+        ast->lists.data[range.start + i] = atom_array_data(atoms)[i];
+    }
+    return range;
+}
+
+static NodeRange flat_attrs(CompactAst *ast, attr_array *attrs) {
+    NodeRange range = reserve_list(ast, attrs->len);
+    for (size_t i = 0; i < attrs->len; i++) {
+        Attribute *attr = &attrs->data[i];
+        CAttr out = {
+            .name = attr->name,
+            .offset = offset_of(&attr->token),
+            .args = reserve_list(ast, attr->args.len),
+        };
+        for (size_t j = 0; j < attr->args.len; j++) {
+            ast->lists.data[out.args.start + j] = push_string(ast, attr->args.data[j]);
+        }
+        cattr_array_push(&ast->attrs, out);
+        ast->lists.data[range.start + i] = ast->attrs.len - 1;
+    }
+    return range;
+}
+
+static NodeIndex flat_type(CompactAst *ast, TypeRef *t) {
+    if (!t) return NODE_NONE;
+
+    CType out = {
+        .kind = t->type,
+        .flags = (t->is_mutable ? CFLAG_MUT : 0) | (t->is_optional ? CFLAG_OPTIONAL : 0),
+        .offset = offset_of(&t->token),
+    };
+    switch (t->type) {
+        case TYPEREF_NAMED:
+            out.a = t->named.name;
+            break;
+        case TYPEREF_POINTER:
+            out.a = flat_type(ast, t->pointer.pointee);
+            break;
+        case TYPEREF_ARRAY:
+            out.a = flat_type(ast, t->array.elem);
+            out.b = push_number(ast, t->array.length);
+            break;
+    }
+    ctype_array_push(&ast->types, out);
+    return ast->types.len - 1;
+}
+
+static NodeIndex flat_expr(CompactAst *ast, Expr *e) {
+    if (!e) return NODE_NONE;
+
+    CExpr out = { .kind = e->type, .offset = offset_of(&e->token) };
+    switch (e->type) {
+        case EXPR_LIT: {
+            Literal *lit = &e->literal;
+            out.op = lit->type;
+            switch (lit->type) {
+                case LITERAL_INT:
+                    out.a = push_number(ast, (uint64_t)lit->_int);
+                    break;
+                case LITERAL_FLOAT: {
+                    uint64_t bits;
+                    memcpy(&bits, &lit->_float, sizeof(bits));
+                    out.a = push_number(ast, bits);
+                    break;
+                }
+                case LITERAL_STRING:
+                    out.a = push_string(ast, lit->string);
+                    break;
+                case LITERAL_BOOL:
+                    out.a = lit->_bool;
+                    break;
+                case LITERAL_CHAR:
+                    out.a = (unsigned char)lit->_char;
+                    break;
+            }
+            break;
+        }
+        case EXPR_IDENT:
+            out.a = e->ident.name;
+            break;
+        case EXPR_PATH: {
+            NodeRange range = flat_atoms(ast, &e->path.components);
+            out.a = range.start;
+            out.b = range.count;
+            break;
+        }
+        case EXPR_UNARY:
+            out.op = e->unary.op;
+            out.a = flat_expr(ast, e->unary.operand);
+            break;
+        case EXPR_BINARY:
+            out.op = e->binary.op;
+            out.a = flat_expr(ast, e->binary.left);
+            out.b = flat_expr(ast, e->binary.right);
+            break;
+        case EXPR_CALL: {
+            exprs_array *args = &e->call.args;
+            NodeRange range = reserve_list(ast, 1 + args->len);
+            ast->lists.data[range.start] = flat_expr(ast, e->call.callee);
+            for (size_t i = 0; i < args->len; i++) {
+                NodeIndex arg = flat_expr(ast, exprs_array_data(args)[i]);
+                ast->lists.data[range.start + 1 + i] = arg;
+            }
+            out.a = range.start;
+            out.b = range.count;
+            break;
+        }
+        case EXPR_INDEX:
+            out.a = flat_expr(ast, e->index.base);
+            out.b = flat_expr(ast, e->index.index);
+            break;
+        case EXPR_MEMBER:
+            out.a = flat_expr(ast, e->member.base);
+            out.b = e->member.member;
+            break;
+        case EXPR_CAST:
+            out.a = flat_type(ast, e->cast.to);
+            out.b = flat_expr(ast, e->cast.expr);
+            break;
+    }
+    cexpr_array_push(&ast->exprs, out);
+    return ast->exprs.len - 1;
+}
+
+static NodeIndex flat_var(CompactAst *ast, VarDecl *var) {
+    CVar out = {
+        .name = var->name,
+        .flags = (var->is_mutable ? CFLAG_MUT : 0) | (var->is_def_init ? CFLAG_DEF_INIT : 0),
+        .offset = offset_of(&var->token),
+        .type = flat_type(ast, var->type),
+        .init = flat_expr(ast, var->init),
+        .attrs = flat_attrs(ast, &var->attributes),
+    };
+    cvar_array_push(&ast->vars, out);
+    return ast->vars.len - 1;
+}
+
+static NodeIndex flat_stmt(CompactAst *ast, Stmt *s);
+
+static void flat_stmts(CompactAst *ast, stmts_array *stmts, CStmt *out) {
+    NodeRange range = reserve_list(ast, stmts->len);
+    for (size_t i = 0; i < stmts->len; i++) {
+        NodeIndex stmt = flat_stmt(ast, stmts->data[i]);
+        ast->lists.data[range.start + i] = stmt;
+    }
+    out->a = range.start;
+    out->b = range.count;
+}
+
+static NodeIndex flat_stmt(CompactAst *ast, Stmt *s) {
+    if (!s) return NODE_NONE;
+
+    CStmt out = { .kind = s->type, .offset = offset_of(&s->token) };
+    switch (s->type) {
+        case STMT_VAR:
+            out.a = flat_var(ast, s->var);
+            break;
+        case STMT_EXPR:
+            out.a = flat_expr(ast, s->expr);
+            break;
+        case STMT_BLOCK:
+            flat_stmts(ast, &s->block.stmts, &out);
+            break;
+        case STMT_UNSAFE:
+            flat_stmts(ast, &s->unsafe.stmts, &out);
+            break;
+        case STMT_RETURN:
+            out.a = flat_expr(ast, s->_return.value);
+            break;
+        case STMT_IF:
+            out.a = flat_expr(ast, s->_if.cond);
+            out.b = flat_stmt(ast, s->_if.then);
+            out.c = flat_stmt(ast, s->_if._else);
+            break;
+        case STMT_FOR:
+            out.a = flat_stmt(ast, s->_for.init);
+            out.b = flat_expr(ast, s->_for.cond);
+            out.c = flat_expr(ast, s->_for.post);
+            out.d = flat_stmt(ast, s->_for.body);
+            break;
+        case STMT_WHILE:
+            out.a = flat_expr(ast, s->_while.cond);
+            out.b = flat_stmt(ast, s->_while.body);
+            break;
+        case STMT_ERROR:
+            break;
+    }
+    cstmt_array_push(&ast->stmts, out);
+    return ast->stmts.len - 1;
+}
+
+static NodeIndex flat_fn(CompactAst *ast, FnDecl *fn) {
+    CFn out = {
+        .name = fn->name,
+        .flags = fn->is_export ? CFLAG_EXPORT : 0,
+        .offset = offset_of(&fn->token),
+        .ret_type = flat_type(ast, fn->ret_type),
+        .params = reserve_list(ast, fn->params.len),
+        .attrs = flat_attrs(ast, &fn->attributes),
+    };
+    for (size_t i = 0; i < fn->params.len; i++) {
+        Param *param = &fn->params.data[i];
+        CVar var = {
+            .name = param->name,
+            .offset = offset_of(&param->token),
+            .type = flat_type(ast, param->type),
+            .attrs = flat_attrs(ast, &param->attributes),
+        };
+        cvar_array_push(&ast->vars, var);
+        ast->lists.data[out.params.start + i] = ast->vars.len - 1;
+    }
+    out.body = flat_stmt(ast, parse_fn_body(fn));
+
+    cfn_array_push(&ast->fns, out);
+    return ast->fns.len - 1;
+}
+
+static NodeIndex flat_aggregate(CompactAst *ast, Atom name, bool is_export, Token *token,
+                                vardecls_array *members, attr_array *attrs) {
+    CAggregate out = {
+        .name = name,
+        .flags = is_export ? CFLAG_EXPORT : 0,
+        .offset = offset_of(token),
+        .members = reserve_list(ast, members->len),
+        .attrs = flat_attrs(ast, attrs),
+    };
+    for (size_t i = 0; i < members->len; i++) {
+        NodeIndex member = flat_var(ast, members->data[i]);
+        ast->lists.data[out.members.start + i] = member;
+    }
+    caggregate_array_push(&ast->aggregates, out);
+    return ast->aggregates.len - 1;
+}
+
+CompactAst ast_compact(Module *m) {
+    CompactAst ast = {
+        .name = m->name,
+        .offset = offset_of(&m->token),
+        .exprs = cexpr_array_init(),
+        .stmts = cstmt_array_init(),
+        .types = ctype_array_init(),
+        .attrs = cattr_array_init(),
+        .vars = cvar_array_init(),
+        .fns = cfn_array_init(),
+        .aggregates = caggregate_array_init(),
+        .includes = cinclude_array_init(),
+        .decls = cdecl_array_init(),
+        .lists = node_array_init(),
+        .numbers = u64_array_init(),
+        .strings = string_array_init(),
+    };
+
+    // Index 0 of every pool is the NODE_NONE placeholder
+    cexpr_array_push(&ast.exprs, (CExpr){});
+    cstmt_array_push(&ast.stmts, (CStmt){});
+    ctype_array_push(&ast.types, (CType){});
+    cvar_array_push(&ast.vars, (CVar){});
+    cfn_array_push(&ast.fns, (CFn){});
+    caggregate_array_push(&ast.aggregates, (CAggregate){});
+
+    for (size_t i = 0; i < m->includes.len; i++) {
+        Include *inc = m->includes.data[i];
+        CInclude out = {
+            .offset = offset_of(&inc->token),
+            .path = flat_atoms(&ast, &inc->path),
+            .alias = inc->alias.has_value ? 1 + push_string(&ast, inc->alias.value) : 0,
+        };
+        cinclude_array_push(&ast.includes, out);
+    }
+
+    for (size_t i = 0; i < m->decls.len; i++) {
+        Decl *decl = m->decls.data[i];
+        CDecl out = { .kind = decl->type };
+        switch (decl->type) {
+            case DECL_FN:
+                out.node = flat_fn(&ast, decl->fn);
+                break;
+            case DECL_VAR:
+                out.node = flat_var(&ast, decl->var);
+                break;
+            case DECL_STRUCT: {
+                StructDecl *s = decl->_struct;
+                out.node = flat_aggregate(&ast, s->name, s->is_export, &s->token, &s->members, &s->attributes);
+                break;
+            }
+            case DECL_UNION: {
+                UnionDecl *u = decl->_union;
+                out.node = flat_aggregate(&ast, u->name, u->is_export, &u->token, &u->members, &u->attributes);
+                break;
+            }
+            case DECL_ERROR:
+                break;
+        }
+        cdecl_array_push(&ast.decls, out);
+    }
+
+    return ast;
+}
+
+typedef struct {
+    CompactAst *ast;
+    Arena *arena;
+} Expander;
+
+static Atom atom_at(Expander *ex, uint32_t atom) {
+    return ex->ast->atom_map ? ex->ast->atom_map[atom] : atom;
+}
+
+static Token token_at(uint32_t offset) {
+    return (Token){ .span = { .start = offset } };
+}
+
+static attr_array expand_attrs(Expander *ex, NodeRange range) {
+    attr_array attrs = attr_array_init_in(ex->arena);
+    attr_array_reserve(&attrs, range.count);
+    for (uint32_t i = 0; i < range.count; i++) {
+        CAttr *in = &ex->ast->attrs.data[compact_list(ex->ast, range)[i]];
+        Attribute attr = {
+            .name = atom_at(ex, in->name),
+            .args = string_array_init_in(ex->arena),
+            .token = token_at(in->offset),
+        };
+        for (uint32_t j = 0; j < in->args.count; j++) {
+            string_array_push(&attr.args, ex->ast->strings.data[compact_list(ex->ast, in->args)[j]]);
+        }
+        attr_array_push(&attrs, attr);
+    }
+    return attrs;
+}
+
+static TypeRef *expand_type(Expander *ex, NodeIndex index) {
+    if (index == NODE_NONE) return NULL;
+
+    CType *in = &ex->ast->types.data[index];
+    TypeRef *t = arena_new(ex->arena, TypeRef);
+    t->type = in->kind;
+    t->is_mutable = in->flags & CFLAG_MUT;
+    t->is_optional = in->flags & CFLAG_OPTIONAL;
+    t->token = token_at(in->offset);
+    switch (t->type) {
+        case TYPEREF_NAMED:
+            t->named.name = atom_at(ex, in->a);
+            break;
+        case TYPEREF_POINTER:
+            t->pointer.pointee = expand_type(ex, in->a);
+            break;
+        case TYPEREF_ARRAY:
+            t->array.elem = expand_type(ex, in->a);
+            t->array.length = ex->ast->numbers.data[in->b];
+            break;
+    }
+    return t;
+}
+
+static Expr *expand_expr(Expander *ex, NodeIndex index) {
+    if (index == NODE_NONE) return NULL;
+
+    CExpr *in = &ex->ast->exprs.data[index];
+    Expr *e = arena_new(ex->arena, Expr);
+    e->type = in->kind;
+    e->token = token_at(in->offset);
+    switch (e->type) {
+        case EXPR_LIT: {
+            Literal *lit = &e->literal;
+            lit->type = in->op;
+            lit->token = e->token;
+            switch (lit->type) {
+                case LITERAL_INT:
+                    lit->_int = (int64_t)ex->ast->numbers.data[in->a];
+                    break;
+                case LITERAL_FLOAT:
+                    memcpy(&lit->_float, &ex->ast->numbers.data[in->a], sizeof(lit->_float));
+                    break;
+                case LITERAL_STRING:
+                    lit->string = ex->ast->strings.data[in->a];
+                    break;
+                case LITERAL_BOOL:
+                    lit->_bool = in->a;
+                    break;
+                case LITERAL_CHAR:
+                    lit->_char = (char)in->a;
+                    break;
+            }
+            break;
+        }
+        case EXPR_IDENT:
+            e->ident.name = atom_at(ex, in->a);
+            break;
+        case EXPR_PATH: {
+            NodeRange range = { in->a, in->b };
+            e->path.components = atom_array_init_in(ex->arena);
+            for (uint32_t i = 0; i < range.count; i++) {
+                atom_array_push(&e->path.components, atom_at(ex, compact_list(ex->ast, range)[i]));
+            }
+            break;
+        }
+        case EXPR_UNARY:
+            e->unary.op = in->op;
+            e->unary.operand = expand_expr(ex, in->a);
+            break;
+        case EXPR_BINARY:
+            e->binary.op = in->op;
+            e->binary.left = expand_expr(ex, in->a);
+            e->binary.right = expand_expr(ex, in->b);
+            break;
+        case EXPR_CALL: {
+            NodeRange range = { in->a, in->b };
+            e->call.callee = expand_expr(ex, compact_list(ex->ast, range)[0]);
+            e->call.args = exprs_array_init_in(ex->arena);
+            exprs_array_reserve(&e->call.args, range.count - 1);
+            for (uint32_t i = 1; i < range.count; i++) {
+                exprs_array_push(&e->call.args, expand_expr(ex, compact_list(ex->ast, range)[i]));
+            }
+            break;
+        }
+        case EXPR_INDEX:
+            e->index.base = expand_expr(ex, in->a);
+            e->index.index = expand_expr(ex, in->b);
+            break;
+        case EXPR_MEMBER:
+            e->member.base = expand_expr(ex, in->a);
+            e->member.member = atom_at(ex, in->b);
+            break;
+        case EXPR_CAST:
+            e->cast.to = expand_type(ex, in->a);
+            e->cast.expr = expand_expr(ex, in->b);
+            break;
+    }
+    return e;
+}
+
+static VarDecl *expand_var(Expander *ex, NodeIndex index) {
+    CVar *in = &ex->ast->vars.data[index];
+    VarDecl *var = arena_new(ex->arena, VarDecl);
+    var->name = atom_at(ex, in->name);
+    var->is_mutable = in->flags & CFLAG_MUT;
+    var->is_def_init = in->flags & CFLAG_DEF_INIT;
+    var->token = token_at(in->offset);
+    var->type = expand_type(ex, in->type);
+    var->init = expand_expr(ex, in->init);
+    var->attributes = expand_attrs(ex, in->attrs);
+    return var;
+}
+
+static Stmt *expand_stmt(Expander *ex, NodeIndex index);
+
+static stmts_array expand_stmts(Expander *ex, CStmt *in) {
+    NodeRange range = { in->a, in->b };
+    stmts_array stmts = stmts_array_init_in(ex->arena);
+    stmts_array_reserve(&stmts, range.count);
+    for (uint32_t i = 0; i < range.count; i++) {
+        stmts_array_push(&stmts, expand_stmt(ex, compact_list(ex->ast, range)[i]));
+    }
+    return stmts;
+}
+
+static Stmt *expand_stmt(Expander *ex, NodeIndex index) {
+    if (index == NODE_NONE) return NULL;
+
+    CStmt *in = &ex->ast->stmts.data[index];
+    Stmt *s = arena_new(ex->arena, Stmt);
+    s->type = in->kind;
+    s->token = token_at(in->offset);
+    switch (s->type) {
+        case STMT_VAR:
+            s->var = expand_var(ex, in->a);
+            break;
+        case STMT_EXPR:
+            s->expr = expand_expr(ex, in->a);
+            break;
+        case STMT_BLOCK:
+            s->block.stmts = expand_stmts(ex, in);
+            break;
+        case STMT_UNSAFE:
+            s->unsafe.stmts = expand_stmts(ex, in);
+            break;
+        case STMT_RETURN:
+            s->_return.value = expand_expr(ex, in->a);
+            break;
+        case STMT_IF:
+            s->_if.cond = expand_expr(ex, in->a);
+            s->_if.then = expand_stmt(ex, in->b);
+            s->_if._else = expand_stmt(ex, in->c);
+            break;
+        case STMT_FOR:
+            s->_for.init = expand_stmt(ex, in->a);
+            s->_for.cond = expand_expr(ex, in->b);
+            s->_for.post = expand_expr(ex, in->c);
+            s->_for.body = expand_stmt(ex, in->d);
+            break;
+        case STMT_WHILE:
+            s->_while.cond = expand_expr(ex, in->a);
+            s->_while.body = expand_stmt(ex, in->b);
+            break;
+        case STMT_ERROR:
+            break;
+    }
+    return s;
+}
+
+static FnDecl *expand_fn(Expander *ex, NodeIndex index) {
+    CFn *in = &ex->ast->fns.data[index];
+    FnDecl *fn = arena_new(ex->arena, FnDecl);
+    fn->name = atom_at(ex, in->name);
+    fn->is_export = in->flags & CFLAG_EXPORT;
+    fn->token = token_at(in->offset);
+    fn->ret_type = expand_type(ex, in->ret_type);
+    fn->attributes = expand_attrs(ex, in->attrs);
+
+    fn->params = param_array_init_in(ex->arena);
+    param_array_reserve(&fn->params, in->params.count);
+    for (uint32_t i = 0; i < in->params.count; i++) {
+        CVar *param = &ex->ast->vars.data[compact_list(ex->ast, in->params)[i]];
+        param_array_push(&fn->params, (Param){
+            .type = expand_type(ex, param->type),
+            .name = atom_at(ex, param->name),
+            .attributes = expand_attrs(ex, param->attrs),
+            .token = token_at(param->offset),
+        });
+    }
+
+    fn->body = expand_stmt(ex, in->body);
+    return fn;
+}
+
+static vardecls_array expand_members(Expander *ex, CAggregate *in) {
+    vardecls_array members = vardecls_array_init_in(ex->arena);
+    vardecls_array_reserve(&members, in->members.count);
+    for (uint32_t i = 0; i < in->members.count; i++) {
+        vardecls_array_push(&members, expand_var(ex, compact_list(ex->ast, in->members)[i]));
+    }
+    return members;
+}
+
+Module *ast_expand(CompactAst *ast, Arena *arena) {
+    Expander ex = { .ast = ast, .arena = arena };
+
+    Module *m = arena_new(arena, Module);
+    m->name = atom_at(&ex, ast->name);
+    m->token = token_at(ast->offset);
+    m->includes = includes_array_init_in(arena);
+    m->decls = decls_array_init_in(arena);
+    includes_array_reserve(&m->includes, ast->includes.len);
+    decls_array_reserve(&m->decls, ast->decls.len);
+
+    for (size_t i = 0; i < ast->includes.len; i++) {
+        CInclude *in = &ast->includes.data[i];
+        Include *inc = arena_new(arena, Include);
+        inc->token = token_at(in->offset);
+        inc->path = atom_array_init_in(arena);
+        for (uint32_t j = 0; j < in->path.count; j++) {
+            atom_array_push(&inc->path, atom_at(&ex, compact_list(ast, in->path)[j]));
+        }
+        if (in->alias) {
+            inc->alias = (string_optional){ true, ast->strings.data[in->alias - 1] };
+        }
+        includes_array_push(&m->includes, inc);
+    }
+
+    for (size_t i = 0; i < ast->decls.len; i++) {
+        CDecl *in = &ast->decls.data[i];
+        Decl *d = arena_new(arena, Decl);
+        d->type = in->kind;
+        switch (d->type) {
+            case DECL_FN:
+                d->fn = expand_fn(&ex, in->node);
+                d->token = d->fn->token;
+                break;
+            case DECL_VAR:
+                d->var = expand_var(&ex, in->node);
+                d->token = d->var->token;
+                break;
+            case DECL_STRUCT: {
+                CAggregate *agg = &ast->aggregates.data[in->node];
+                StructDecl *s = arena_new(arena, StructDecl);
+                s->name = atom_at(&ex, agg->name);
+                s->is_export = agg->flags & CFLAG_EXPORT;
+                s->token = token_at(agg->offset);
+                s->members = expand_members(&ex, agg);
+                s->attributes = expand_attrs(&ex, agg->attrs);
+                d->_struct = s;
+                d->token = s->token;
+                break;
+            }
+            case DECL_UNION: {
+                CAggregate *agg = &ast->aggregates.data[in->node];
+                UnionDecl *u = arena_new(arena, UnionDecl);
+                u->name = atom_at(&ex, agg->name);
+                u->is_export = agg->flags & CFLAG_EXPORT;
+                u->token = token_at(agg->offset);
+                u->members = expand_members(&ex, agg);
+                u->attributes = expand_attrs(&ex, agg->attrs);
+                d->_union = u;
+                d->token = u->token;
+                break;
+            }
+            case DECL_ERROR:
+                break;
+        }
+        decls_array_push(&m->decls, d);
+    }
+
+    return m;
+}
+
+typedef enum {
+    POOL_EXPRS,
+    POOL_STMTS,
+    POOL_TYPES,
+    POOL_ATTRS,
+    POOL_VARS,
+    POOL_FNS,
+    POOL_AGGREGATES,
+    POOL_COUNT
+} Pool;
+
+typedef struct {
+    CompactAst *ast;
+    size_t atoms;
+    size_t source_length;
+    size_t len[POOL_COUNT];
+    bool *seen[POOL_COUNT];     // nodes already referenced
+} Checker;
+
+#define FROM_OTHER_POOL UINT32_MAX
+
+// A reference to a node of `pool`. Children are flattened before their
+// parents, so a reference from node `from` of the same pool must point
+// below it, which rules out cycles. Each node may be referenced once, so
+// expanding does no more work than there are nodes.
+static bool check_node(Checker *ck, Pool pool, NodeIndex index, uint32_t from, bool required) {
+    if (index == NODE_NONE && pool != POOL_ATTRS) return !required;
+    if (index >= ck->len[pool] || index >= from || ck->seen[pool][index]) return false;
+    ck->seen[pool][index] = true;
+    return true;
+}
+
+static bool check_range(Checker *ck, NodeRange range) {
+    return range.start <= ck->ast->lists.len && range.count <= ck->ast->lists.len - range.start;
+}
+
+// Every entry of `range` refers to a node of `pool`
+static bool check_nodes(Checker *ck, NodeRange range, Pool pool, uint32_t from) {
+    if (!check_range(ck, range)) return false;
+    for (uint32_t i = 0; i < range.count; i++) {
+        if (!check_node(ck, pool, compact_list(ck->ast, range)[i], from, true)) return false;
+    }
+    return true;
+}
+
+static bool check_atoms(Checker *ck, NodeRange range) {
+    if (!check_range(ck, range)) return false;
+    for (uint32_t i = 0; i < range.count; i++) {
+        if (compact_list(ck->ast, range)[i] >= ck->atoms) return false;
+    }
+    return true;
+}
+
+static bool check_expr(Checker *ck, uint32_t i) {
+    CExpr *in = &ck->ast->exprs.data[i];
+    if (in->offset > ck->source_length) return false;
+    switch (in->kind) {
+        case EXPR_LIT:
+            switch (in->op) {
+                case LITERAL_INT:
+                case LITERAL_FLOAT: return in->a < ck->ast->numbers.len;
+                case LITERAL_STRING: return in->a < ck->ast->strings.len;
+                case LITERAL_BOOL:
+                case LITERAL_CHAR: return true;
+            }
+            return false;
+        case EXPR_IDENT:
+            return in->a < ck->atoms;
+        case EXPR_PATH:
+            return check_atoms(ck, (NodeRange){ in->a, in->b });
+        case EXPR_UNARY:
+            return in->op <= UOP_ADDR && check_node(ck, POOL_EXPRS, in->a, i, true);
+        case EXPR_BINARY:
+            return in->op <= BINOP_ADD_ASSIGN && check_node(ck, POOL_EXPRS, in->a, i, true)
+                && check_node(ck, POOL_EXPRS, in->b, i, true);
+        case EXPR_CALL:
+            return in->b >= 1 && check_nodes(ck, (NodeRange){ in->a, in->b }, POOL_EXPRS, i);
+        case EXPR_INDEX:
+            return check_node(ck, POOL_EXPRS, in->a, i, true) && check_node(ck, POOL_EXPRS, in->b, i, true);
+        case EXPR_MEMBER:
+            return check_node(ck, POOL_EXPRS, in->a, i, true) && in->b < ck->atoms;
+        case EXPR_CAST:
+            return check_node(ck, POOL_TYPES, in->a, FROM_OTHER_POOL, true)
+                && check_node(ck, POOL_EXPRS, in->b, i, true);
+    }
+    return false;
+}
+
+// Sema never sees a module with errors, so neither does the cache
+static bool check_stmt(Checker *ck, uint32_t i) {
+    CStmt *in = &ck->ast->stmts.data[i];
+    if (in->offset > ck->source_length) return false;
+    switch (in->kind) {
+        case STMT_VAR:
+            return check_node(ck, POOL_VARS, in->a, FROM_OTHER_POOL, true);
+        case STMT_EXPR:
+            return check_node(ck, POOL_EXPRS, in->a, FROM_OTHER_POOL, true);
+        case STMT_BLOCK:
+        case STMT_UNSAFE:
+            return check_nodes(ck, (NodeRange){ in->a, in->b }, POOL_STMTS, i);
+        case STMT_RETURN:
+            return check_node(ck, POOL_EXPRS, in->a, FROM_OTHER_POOL, false);
+        case STMT_IF:
+            return check_node(ck, POOL_EXPRS, in->a, FROM_OTHER_POOL, false)
+                && check_node(ck, POOL_STMTS, in->b, i, false)
+                && check_node(ck, POOL_STMTS, in->c, i, false);
+        case STMT_FOR:
+            return check_node(ck, POOL_STMTS, in->a, i, false)
+                && check_node(ck, POOL_EXPRS, in->b, FROM_OTHER_POOL, false)
+                && check_node(ck, POOL_EXPRS, in->c, FROM_OTHER_POOL, false)
+                && check_node(ck, POOL_STMTS, in->d, i, false);
+        case STMT_WHILE:
+            return check_node(ck, POOL_EXPRS, in->a, FROM_OTHER_POOL, false)
+                && check_node(ck, POOL_STMTS, in->b, i, false);
+        case STMT_ERROR:
+            return false;
+    }
+    return false;
+}
+
+static bool check_type(Checker *ck, uint32_t i) {
+    CType *in = &ck->ast->types.data[i];
+    if (in->offset > ck->source_length) return false;
+    switch (in->kind) {
+        case TYPEREF_NAMED:
+            return in->a < ck->atoms;
+        case TYPEREF_POINTER:
+            return check_node(ck, POOL_TYPES, in->a, i, true);
+        case TYPEREF_ARRAY:
+            return check_node(ck, POOL_TYPES, in->a, i, true) && in->b < ck->ast->numbers.len;
+    }
+    return false;
+}
+
+static bool check_attr(Checker *ck, uint32_t i) {
+    CAttr *in = &ck->ast->attrs.data[i];
+    if (in->name >= ck->atoms || in->offset > ck->source_length || !check_range(ck, in->args)) return false;
+    for (uint32_t j = 0; j < in->args.count; j++) {
+        if (compact_list(ck->ast, in->args)[j] >= ck->ast->strings.len) return false;
+    }
+    return true;
+}
+
+static bool check_var(Checker *ck, uint32_t i) {
+    CVar *in = &ck->ast->vars.data[i];
+    return in->name < ck->atoms && in->offset <= ck->source_length
+        && check_node(ck, POOL_TYPES, in->type, FROM_OTHER_POOL, true)
+        && check_node(ck, POOL_EXPRS, in->init, FROM_OTHER_POOL, false)
+        && check_nodes(ck, in->attrs, POOL_ATTRS, FROM_OTHER_POOL);
+}
+
+static bool check_fn(Checker *ck, uint32_t i) {
+    CFn *in = &ck->ast->fns.data[i];
+    return in->name < ck->atoms && in->offset <= ck->source_length
+        && check_node(ck, POOL_TYPES, in->ret_type, FROM_OTHER_POOL, true)
+        && check_node(ck, POOL_STMTS, in->body, FROM_OTHER_POOL, false)
+        && check_nodes(ck, in->params, POOL_VARS, FROM_OTHER_POOL)
+        && check_nodes(ck, in->attrs, POOL_ATTRS, FROM_OTHER_POOL);
+}
+
+static bool check_aggregate(Checker *ck, uint32_t i) {
+    CAggregate *in = &ck->ast->aggregates.data[i];
+    return in->name < ck->atoms && in->offset <= ck->source_length
+        && check_nodes(ck, in->members, POOL_VARS, FROM_OTHER_POOL)
+        && check_nodes(ck, in->attrs, POOL_ATTRS, FROM_OTHER_POOL);
+}
+
+static bool check_decl(Checker *ck, CDecl *in) {
+    switch (in->kind) {
+        case DECL_FN: return check_node(ck, POOL_FNS, in->node, FROM_OTHER_POOL, true);
+        case DECL_VAR: return check_node(ck, POOL_VARS, in->node, FROM_OTHER_POOL, true);
+        case DECL_STRUCT:
+        case DECL_UNION: return check_node(ck, POOL_AGGREGATES, in->node, FROM_OTHER_POOL, true);
+        case DECL_ERROR: return false;
+    }
+    return false;
+}
+
+static bool check_include(Checker *ck, CInclude *in) {
+    return in->offset <= ck->source_length && check_atoms(ck, in->path)
+        && in->alias <= ck->ast->strings.len;
+}
+
+bool compact_valid(CompactAst *ast, size_t atoms, size_t source_length) {
+    Checker ck = {
+        .ast = ast,
+        .atoms = atoms,
+        .source_length = source_length,
+        .len = {
+            [POOL_EXPRS] = ast->exprs.len,
+            [POOL_STMTS] = ast->stmts.len,
+            [POOL_TYPES] = ast->types.len,
+            [POOL_ATTRS] = ast->attrs.len,
+            [POOL_VARS] = ast->vars.len,
+            [POOL_FNS] = ast->fns.len,
+            [POOL_AGGREGATES] = ast->aggregates.len,
+        },
+    };
+    for (Pool p = 0; p < POOL_COUNT; p++) {
+        ck.seen[p] = calloc(ck.len[p] ? ck.len[p] : 1, sizeof(bool));
+        if (!ck.seen[p]) {
+            fprintf(stderr, "compact_valid: malloc failed\n");
+            exit(1);
+        }
+    }
+
+    // Node 0 of every pool but attrs is the unused NODE_NONE placeholder
+    bool ok = ast->name < atoms && ast->offset <= source_length;
+    for (uint32_t i = 1; ok && i < ast->exprs.len; i++) ok = check_expr(&ck, i);
+    for (uint32_t i = 1; ok && i < ast->stmts.len; i++) ok = check_stmt(&ck, i);
+    for (uint32_t i = 1; ok && i < ast->types.len; i++) ok = check_type(&ck, i);
+    for (uint32_t i = 0; ok && i < ast->attrs.len; i++) ok = check_attr(&ck, i);
+    for (uint32_t i = 1; ok && i < ast->vars.len; i++) ok = check_var(&ck, i);
+    for (uint32_t i = 1; ok && i < ast->fns.len; i++) ok = check_fn(&ck, i);
+    for (uint32_t i = 1; ok && i < ast->aggregates.len; i++) ok = check_aggregate(&ck, i);
+    for (size_t i = 0; ok && i < ast->decls.len; i++) ok = check_decl(&ck, &ast->decls.data[i]);
+    for (size_t i = 0; ok && i < ast->includes.len; i++) ok = check_include(&ck, &ast->includes.data[i]);
+
+    for (Pool p = 0; p < POOL_COUNT; p++) free(ck.seen[p]);
+    return ok;
+}
+
+void compact_free(CompactAst *ast) {
+    free(ast->atom_map);
+    string_array_free(&ast->strings);
+    if (ast->mapping) {
+        munmap(ast->mapping, ast->mapping_size);
+        return;
+    }
+
+    cexpr_array_free(&ast->exprs);
+    cstmt_array_free(&ast->stmts);
+    ctype_array_free(&ast->types);
+    cattr_array_free(&ast->attrs);
+    cvar_array_free(&ast->vars);
+    cfn_array_free(&ast->fns);
+    caggregate_array_free(&ast->aggregates);
+    cinclude_array_free(&ast->includes);
+    cdecl_array_free(&ast->decls);
+    node_array_free(&ast->lists);
+    u64_array_free(&ast->numbers);
+}
+
+size_t compact_size(CompactAst *ast) {
+    return ast->exprs.cap * sizeof(CExpr)
+         + ast->stmts.cap * sizeof(CStmt)
+         + ast->types.cap * sizeof(CType)
+         + ast->attrs.cap * sizeof(CAttr)
+         + ast->vars.cap * sizeof(CVar)
+         + ast->fns.cap * sizeof(CFn)
+         + ast->aggregates.cap * sizeof(CAggregate)
+         + ast->includes.cap * sizeof(CInclude)
+         + ast->decls.cap * sizeof(CDecl)
+         + ast->lists.cap * sizeof(NodeIndex)
+         + ast->numbers.cap * sizeof(uint64_t)
+         + ast->strings.cap * sizeof(String);
+}
@@ -9,6 +9,7 @@
 #include "lexer.h"
 
 INSTANTIATE(String, string, ARRAY_TEMPLATE)
+INSTANTIATE(Atom, atom, SMALL_ARRAY_TEMPLATE, 4)
 
 typedef struct Expr Expr;
 typedef struct Stmt Stmt;
@@ -25,7 +26,7 @@ typedef struct Include Include;
 typedef struct Literal Literal;
 typedef struct Param Param;
 
-INSTANTIATE(Expr *, exprs, ARRAY_TEMPLATE)
+INSTANTIATE(Expr *, exprs, SMALL_ARRAY_TEMPLATE, 4)
 
 typedef enum {
     UOP_NEG,
@@ -68,7 +69,7 @@ typedef enum {
 } SymbolFlags;
 
 typedef struct {
-    String name;
+    Atom name;
     string_array args;
     Token token;
 } Attribute;
@@ -81,7 +82,7 @@ struct TypeRef {
     } type;
     union {
         struct {
-            String name;
+            Atom name;
         } named;
         struct {
             TypeRef *pointee;
@@ -95,6 +96,7 @@ struct TypeRef {
     bool is_mutable;
     bool is_optional;
     Symbol *type_symbol;
+    TypeRef *pointer_type;  // the type of &x for an x of this type, made once
     Token token;
 };
 
@@ -133,10 +135,10 @@ struct Expr {
     union {
         Literal literal;
         struct {
-            String name;
+            Atom name;
         } ident;
         struct {
-            string_array components;
+            atom_array components;
         } path;
         struct {
             UnaryOp op;
@@ -157,7 +159,7 @@ struct Expr {
         } index;
         struct {
             Expr *base;
-            String member;
+            Atom member;
         } member;
         struct {
             TypeRef *to;
@@ -183,6 +185,7 @@ struct Stmt {
         STMT_FOR,
         STMT_WHILE,
         STMT_UNSAFE,
+        STMT_ERROR,     // a statement that failed to parse
     } type;
 
     union {
@@ -214,7 +217,7 @@ struct Stmt {
         } unsafe;
     };
 
-    Scope *scope;
+    Scope *scope;           // only while sema checks the enclosing function
     Token token;
 };
 
@@ -222,7 +225,7 @@ INSTANTIATE(Attribute, attr, ARRAY_TEMPLATE)
 
 struct Param {
     TypeRef *type;
-    String name;
+    Atom name;
     attr_array attributes;
     Symbol *symbol;
     Token token;
@@ -230,7 +233,7 @@ struct Param {
 
 struct VarDecl {
     TypeRef *type;
-    String name;
+    Atom name;
     Expr *init;
     attr_array attributes;
     Symbol *symbol;
@@ -241,14 +244,22 @@ struct VarDecl {
 
 INSTANTIATE(Param, param, ARRAY_TEMPLATE)
 
+// A function body the parser skipped over; parse_fn_body() builds it
+typedef struct {
+    token_array *tokens;    // NULL once parsed (or if it was never skipped)
+    size_t start;           // index of the body's '{'
+    Arena *arena;
+} LazyBody;
+
 struct FnDecl {
-    String name;
+    Atom name;
     TypeRef *ret_type;
     param_array params;
-    Stmt *body;
+    Stmt *body;             // read through parse_fn_body(), it may not exist yet
+    LazyBody lazy_body;
     attr_array attributes;
     Symbol *symbol;
-    Scope *local_scope;
+    Scope *local_scope;     // only while sema checks the body
     bool is_export;
     Token token;
 };
@@ -258,7 +269,8 @@ struct Decl {
         DECL_FN,
         DECL_VAR,
         DECL_STRUCT,
-        DECL_UNION
+        DECL_UNION,
+        DECL_ERROR      // a declaration that failed to parse
     } type;
     union {
         FnDecl *fn;
@@ -271,10 +283,9 @@ struct Decl {
 };
 
 INSTANTIATE(VarDecl *, vardecls, ARRAY_TEMPLATE)
-INSTANTIATE(size_t, size, ARRAY_TEMPLATE)
 
 struct StructDecl {
-    String name;
+    Atom name;
     vardecls_array members;
     attr_array attributes;
     Symbol *symbol;
@@ -286,7 +297,7 @@ struct StructDecl {
 };
 
 struct UnionDecl {
-    String name;
+    Atom name;
     vardecls_array members;
     attr_array attributes;
     Symbol *symbol;
@@ -299,18 +310,18 @@ struct UnionDecl {
 INSTANTIATE(String, string, OPTIONAL_TEMPLATE)
 
 struct Include {
-    string_array path;
+    atom_array path;
     string_optional alias;
     Module *resolved;
     Token token;
 };
 
 struct Symbol {
-    String name;
+    Atom name;
     Decl *decl;
     TypeRef *type;
     uint32_t flags;
-    Scope *defined_in;
+    Scope *defined_in;      // for a local, only while its function is checked
     Token token;
 };
 
@@ -325,7 +336,7 @@ INSTANTIATE(Include *, includes, ARRAY_TEMPLATE)
 INSTANTIATE(Decl *, decls, ARRAY_TEMPLATE)
 
 struct Module {
-    String name;
+    Atom name;
     includes_array includes;
     decls_array decls;
     Scope *scope;
@@ -334,4 +345,170 @@ struct Module {
     Arena *arena;
 };
 
+// Compact AST: a flattened copy of a Module whose nodes live in one pool
+// per kind and refer to each other by 32-bit index, index 0 meaning "none".
+// Locations are byte offsets into the source, and child lists are runs of
+// indices in `lists`. Built by ast_compact(), it is a serialisation layout:
+// the AST cache stores it and ast_expand() turns it back into a Module.
+// Nothing walks it directly, sema included: sema hangs Symbol and Scope
+// pointers off the nodes it checks, which the pools have no room for.
+typedef uint32_t NodeIndex;
+#define NODE_NONE 0
+
+INSTANTIATE(NodeIndex, node, ARRAY_TEMPLATE)
+INSTANTIATE(uint64_t, u64, ARRAY_TEMPLATE)
+
+typedef struct {
+    uint32_t start;     // into CompactAst.lists
+    uint32_t count;
+} NodeRange;
+
+// Operands by kind (an Expr type):
+//   EXPR_LIT     op: literal type, a: value (see CompactAst), b: 0
+//   EXPR_IDENT   a: atom
+//   EXPR_PATH    a, b: atoms
+//   EXPR_UNARY   op, a: operand
+//   EXPR_BINARY  op, a: left, b: right
+//   EXPR_CALL    a, b: the callee then the arguments
+//   EXPR_INDEX   a: base, b: index
+//   EXPR_MEMBER  a: base, b: member atom
+//   EXPR_CAST    a: type, b: expr
+// where "a, b" is a NodeRange
+typedef struct {
+    uint8_t kind;
+    uint8_t op;
+    uint32_t offset;
+    uint32_t a, b;
+} CExpr;
+
+// Operands by kind (a Stmt type):
+//   STMT_VAR            a: var
+//   STMT_EXPR           a: expr
+//   STMT_BLOCK/UNSAFE   a, b: statements
+//   STMT_RETURN         a: value
+//   STMT_IF             a: cond, b: then, c: else
+//   STMT_FOR            a: init, b: cond, c: post, d: body
+//   STMT_WHILE          a: cond, b: body
+typedef struct {
+    uint8_t kind;
+    uint32_t offset;
+    uint32_t a, b, c, d;
+} CStmt;
+
+typedef enum {
+    CFLAG_MUT = 1 << 0,
+    CFLAG_OPTIONAL = 1 << 1,
+    CFLAG_DEF_INIT = 1 << 2,
+    CFLAG_EXPORT = 1 << 3,
+} CompactFlags;
+
+// TYPEREF_NAMED a: atom, TYPEREF_POINTER a: pointee,
+// TYPEREF_ARRAY a: elem, b: index of the length in `numbers`
+typedef struct {
+    uint8_t kind;
+    uint8_t flags;
+    uint32_t offset;
+    uint32_t a, b;
+} CType;
+
+typedef struct {
+    Atom name;
+    uint32_t offset;
+    NodeRange args;     // indices into `strings`
+} CAttr;
+
+// Variables, parameters and struct/union members
+typedef struct {
+    Atom name;
+    uint8_t flags;
+    uint32_t offset;
+    NodeIndex type;
+    NodeIndex init;
+    NodeRange attrs;
+} CVar;
+
+typedef struct {
+    Atom name;
+    uint8_t flags;
+    uint32_t offset;
+    NodeIndex ret_type;
+    NodeIndex body;     // a block, NODE_NONE for a declaration
+    NodeRange params;   // vars
+    NodeRange attrs;
+} CFn;
+
+// Structs and unions, told apart by the owning CDecl
+typedef struct {
+    Atom name;
+    uint8_t flags;
+    uint32_t offset;
+    NodeRange members; // vars
+    NodeRange attrs;
+} CAggregate;
+
+typedef struct {
+    uint8_t kind;       // a Decl type
+    NodeIndex node;     // into fns, vars or aggregates
+} CDecl;
+
+typedef struct {
+    uint32_t offset;
+    NodeRange path;     // atoms
+    uint32_t alias;     // 1 + index into `strings`, 0 if none
+} CInclude;
+
+INSTANTIATE(CExpr, cexpr, ARRAY_TEMPLATE)
+INSTANTIATE(CStmt, cstmt, ARRAY_TEMPLATE)
+INSTANTIATE(CType, ctype, ARRAY_TEMPLATE)
+INSTANTIATE(CAttr, cattr, ARRAY_TEMPLATE)
+INSTANTIATE(CVar, cvar, ARRAY_TEMPLATE)
+INSTANTIATE(CFn, cfn, ARRAY_TEMPLATE)
+INSTANTIATE(CAggregate, caggregate, ARRAY_TEMPLATE)
+INSTANTIATE(CDecl, cdecl, ARRAY_TEMPLATE)
+INSTANTIATE(CInclude, cinclude, ARRAY_TEMPLATE)
+
+// Literal values: ints and floats (by bit pattern) are indices into
+// `numbers`, strings into `strings`, chars and bools are stored inline
+typedef struct {
+    Atom name;
+    uint32_t offset;
+
+    cexpr_array exprs;
+    cstmt_array stmts;
+    ctype_array types;
+    cattr_array attrs;
+    cvar_array vars;
+    cfn_array fns;
+    caggregate_array aggregates;
+    cinclude_array includes;
+    cdecl_array decls;
+
+    node_array lists;
+    u64_array numbers;
+    string_array strings;
+
+    // Set when loaded from a cache file: the pools point into its mapping,
+    // and atoms in them are translated through atom_map
+    void *mapping;
+    size_t mapping_size;
+    Atom *atom_map;
+} CompactAst;
+
+// Flattens `m`, parsing any lazily skipped function bodies on the way
+CompactAst ast_compact(Module *m);
+// Rebuilds a pointer AST from `ast` in `arena`. Its tokens carry only the
+// node's source offset, and its strings are shared with `ast`.
+Module *ast_expand(CompactAst *ast, Arena *arena);
+void compact_free(CompactAst *ast);
+// Whether a CompactAst from outside the process, such as a cache file, is
+// safe to expand: every index, range, atom and offset is in bounds and the
+// nodes form trees. Its pools may use atoms below `atoms`.
+bool compact_valid(CompactAst *ast, size_t atoms, size_t source_length);
+// Bytes held by the pools (capacity, not just length)
+size_t compact_size(CompactAst *ast);
+
+static inline NodeIndex *compact_list(CompactAst *ast, NodeRange range) {
+    return ast->lists.data + range.start;
+}
+
 #endif
\ No newline at end of file
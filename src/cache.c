@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cache.h"
+
+static const size_t record_size[CACHE_SECTION_COUNT] = {
+    [CACHE_EXPRS] = sizeof(CExpr),
+    [CACHE_STMTS] = sizeof(CStmt),
+    [CACHE_TYPES] = sizeof(CType),
+    [CACHE_ATTRS] = sizeof(CAttr),
+    [CACHE_VARS] = sizeof(CVar),
+    [CACHE_FNS] = sizeof(CFn),
+    [CACHE_AGGREGATES] = sizeof(CAggregate),
+    [CACHE_INCLUDES] = sizeof(CInclude),
+    [CACHE_DECLS] = sizeof(CDecl),
+    [CACHE_LISTS] = sizeof(NodeIndex),
+    [CACHE_NUMBERS] = sizeof(uint64_t),
+    [CACHE_STRINGS] = sizeof(CacheString),
+    [CACHE_ATOMS] = sizeof(CacheString),
+    [CACHE_BYTES] = 1,
+};
+
+static uint64_t align8(uint64_t n) {
+    return (n + 7) & ~(uint64_t)7;
+}
+
+static uint64_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+// Eight bytes per step; not cryptographic, an entry is also checked
+// against the source length
+uint64_t cache_hash(String contents) {
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ contents.length;
+    size_t i = 0;
+    for (; i + 8 <= contents.length; i += 8) {
+        uint64_t word;
+        memcpy(&word, contents.data + i, sizeof(word));
+        h = (h ^ word) * 0x100000001b3ull;
+        h ^= h >> 29;
+    }
+
+    uint64_t tail = 0;
+    memcpy(&tail, contents.data + i, contents.length - i);
+    return mix(h ^ tail);
+}
+
+char *cache_path(char *dir, uint64_t hash) {
+    size_t n = strlen(dir) + 1 + 16 + sizeof(".ast");
+    char *path = malloc(n);
+    if (!path) {
+        fprintf(stderr, "cache_path: malloc failed\n");
+        exit(1);
+    }
+    snprintf(path, n, "%s/%016llx.ast", dir, (unsigned long long)hash);
+    return path;
+}
+
+static bool write_padding(FILE *f, uint64_t *pos, uint64_t to) {
+    static const char zeros[8] = {0};
+    bool ok = fwrite(zeros, 1, to - *pos, f) == to - *pos;
+    *pos = to;
+    return ok;
+}
+
+static bool write_sections(FILE *f, CacheHeader *header, const void **data, CompactAst *ast, size_t atoms) {
+    uint64_t pos = sizeof(CacheHeader);
+    bool ok = fwrite(header, sizeof(CacheHeader), 1, f) == 1;
+
+    for (int s = 0; ok && s < CACHE_SECTION_COUNT; s++) {
+        CacheSectionEntry *entry = &header->sections[s];
+        ok = write_padding(f, &pos, entry->offset);
+
+        if (s == CACHE_BYTES) {
+            for (size_t i = 0; ok && i < ast->strings.len; i++) {
+                String str = ast->strings.data[i];
+                ok = fwrite(str.data, 1, str.length, f) == str.length;
+            }
+            for (Atom a = 0; ok && a < atoms; a++) {
+                String name = atom_string(a);
+                ok = fwrite(name.data, 1, name.length, f) == name.length;
+            }
+        } else if (entry->count) {
+            ok = ok && fwrite(data[s], record_size[s], entry->count, f) == entry->count;
+        }
+        pos += entry->count * record_size[s];
+    }
+    return ok;
+}
+
+bool cache_store(char *path, CompactAst *ast, uint64_t hash, size_t length) {
+    size_t atoms = atom_count();
+    CacheString *strings = malloc((ast->strings.len + atoms) * sizeof(CacheString));
+    if (!strings) {
+        fprintf(stderr, "cache_store: malloc failed\n");
+        exit(1);
+    }
+    CacheString *names = strings + ast->strings.len;
+
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < ast->strings.len; i++) {
+        strings[i] = (CacheString){ .offset = bytes, .length = ast->strings.data[i].length };
+        bytes += strings[i].length;
+    }
+    for (Atom a = 0; a < atoms; a++) {
+        names[a] = (CacheString){ .offset = bytes, .length = atom_string(a).length };
+        bytes += names[a].length;
+    }
+
+    const void *data[CACHE_SECTION_COUNT] = {
+        [CACHE_EXPRS] = ast->exprs.data,
+        [CACHE_STMTS] = ast->stmts.data,
+        [CACHE_TYPES] = ast->types.data,
+        [CACHE_ATTRS] = ast->attrs.data,
+        [CACHE_VARS] = ast->vars.data,
+        [CACHE_FNS] = ast->fns.data,
+        [CACHE_AGGREGATES] = ast->aggregates.data,
+        [CACHE_INCLUDES] = ast->includes.data,
+        [CACHE_DECLS] = ast->decls.data,
+        [CACHE_LISTS] = ast->lists.data,
+        [CACHE_NUMBERS] = ast->numbers.data,
+        [CACHE_STRINGS] = strings,
+        [CACHE_ATOMS] = names,
+    };
+    size_t counts[CACHE_SECTION_COUNT] = {
+        [CACHE_EXPRS] = ast->exprs.len,
+        [CACHE_STMTS] = ast->stmts.len,
+        [CACHE_TYPES] = ast->types.len,
+        [CACHE_ATTRS] = ast->attrs.len,
+        [CACHE_VARS] = ast->vars.len,
+        [CACHE_FNS] = ast->fns.len,
+        [CACHE_AGGREGATES] = ast->aggregates.len,
+        [CACHE_INCLUDES] = ast->includes.len,
+        [CACHE_DECLS] = ast->decls.len,
+        [CACHE_LISTS] = ast->lists.len,
+        [CACHE_NUMBERS] = ast->numbers.len,
+        [CACHE_STRINGS] = ast->strings.len,
+        [CACHE_ATOMS] = atoms,
+        [CACHE_BYTES] = bytes,
+    };
+
+    CacheHeader header = {
+        .magic = CACHE_MAGIC,
+        .version = CACHE_VERSION,
+        .section_count = CACHE_SECTION_COUNT,
+        .source_hash = hash,
+        .source_length = length,
+        .module_name = ast->name,
+        .module_offset = ast->offset,
+    };
+    uint64_t offset = align8(sizeof(CacheHeader));
+    for (int s = 0; s < CACHE_SECTION_COUNT; s++) {
+        header.sections[s] = (CacheSectionEntry){ .offset = offset, .count = counts[s] };
+        offset = align8(offset + counts[s] * record_size[s]);
+    }
+
+    // The cache directory is made on first use
+    char *slash = strrchr(path, '/');
+    if (slash) {
+        char *dir = strndup(path, slash - path);
+        if (dir) mkdir(dir, 0777);
+        free(dir);
+    }
+
+    size_t n = strlen(path) + 32;
+    char *tmp = malloc(n);
+    if (!tmp) {
+        fprintf(stderr, "cache_store: malloc failed\n");
+        exit(1);
+    }
+    snprintf(tmp, n, "%s.%ld.tmp", path, (long)getpid());
+
+    bool ok = false;
+    FILE *f = fopen(tmp, "wb");
+    if (f) {
+        ok = write_sections(f, &header, data, ast, atoms);
+        ok = (fclose(f) == 0) && ok;
+        ok = ok && rename(tmp, path) == 0;
+        if (!ok) unlink(tmp);
+    }
+
+    free(tmp);
+    free(strings);
+    return ok;
+}
+
+static bool strings_in_bounds(CacheString *strings, uint64_t count, uint64_t bytes) {
+    for (uint64_t i = 0; i < count; i++) {
+        if (strings[i].offset > bytes || strings[i].length > bytes - strings[i].offset) return false;
+    }
+    return true;
+}
+
+#define MAPPED(N, s) (N##_array){ \
+    .data = (void*)(base + header->sections[s].offset), \
+    .len = header->sections[s].count, \
+    .cap = header->sections[s].count, \
+    .alive = true, \
+}
+
+bool cache_load(char *path, uint64_t hash, size_t length, CompactAst *out) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CacheHeader)) {
+        close(fd);
+        return false;
+    }
+
+    size_t size = st.st_size;
+    char *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return false;
+
+    CacheHeader *header = (CacheHeader*)base;
+    bool ok = memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0
+        && header->version == CACHE_VERSION
+        && header->section_count == CACHE_SECTION_COUNT
+        && header->source_hash == hash
+        && header->source_length == length;
+    for (int s = 0; ok && s < CACHE_SECTION_COUNT; s++) {
+        CacheSectionEntry *entry = &header->sections[s];
+        ok = entry->offset % 8 == 0 && entry->offset <= size
+            && entry->count <= (size - entry->offset) / record_size[s];
+    }
+
+    char *bytes = base + header->sections[CACHE_BYTES].offset;
+    uint64_t byte_count = header->sections[CACHE_BYTES].count;
+    CacheString *strings = (CacheString*)(base + header->sections[CACHE_STRINGS].offset);
+    CacheString *names = (CacheString*)(base + header->sections[CACHE_ATOMS].offset);
+    ok = ok && strings_in_bounds(strings, header->sections[CACHE_STRINGS].count, byte_count)
+        && strings_in_bounds(names, header->sections[CACHE_ATOMS].count, byte_count);
+    if (!ok) {
+        munmap(base, size);
+        return false;
+    }
+
+    *out = (CompactAst){
+        .name = header->module_name,
+        .offset = header->module_offset,
+        .exprs = MAPPED(cexpr, CACHE_EXPRS),
+        .stmts = MAPPED(cstmt, CACHE_STMTS),
+        .types = MAPPED(ctype, CACHE_TYPES),
+        .attrs = MAPPED(cattr, CACHE_ATTRS),
+        .vars = MAPPED(cvar, CACHE_VARS),
+        .fns = MAPPED(cfn, CACHE_FNS),
+        .aggregates = MAPPED(caggregate, CACHE_AGGREGATES),
+        .includes = MAPPED(cinclude, CACHE_INCLUDES),
+        .decls = MAPPED(cdecl, CACHE_DECLS),
+        .lists = MAPPED(node, CACHE_LISTS),
+        .numbers = MAPPED(u64, CACHE_NUMBERS),
+        .strings = string_array_init(),
+        .mapping = base,
+        .mapping_size = size,
+    };
+
+    for (uint64_t i = 0; i < header->sections[CACHE_STRINGS].count; i++) {
+        string_array_push(&out->strings, (String){ bytes + strings[i].offset, strings[i].length });
+    }
+
+    uint64_t atoms = header->sections[CACHE_ATOMS].count;
+    if (!compact_valid(out, atoms, length)) {
+        string_array_free(&out->strings);
+        munmap(base, size);
+        return false;
+    }
+
+    out->atom_map = malloc((atoms ? atoms : 1) * sizeof(Atom));
+    if (!out->atom_map) {
+        fprintf(stderr, "cache_load: malloc failed\n");
+        exit(1);
+    }
+    for (uint64_t a = 0; a < atoms; a++) {
+        out->atom_map[a] = a == ATOM_EMPTY ? ATOM_EMPTY : intern((String){ bytes + names[a].offset, names[a].length });
+    }
+    return true;
+}
@@ -0,0 +1,74 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ast.h"
+
+// On-disk copy of a module's CompactAst, keyed by a hash of its source so
+// an unchanged file is mapped back instead of being lexed and parsed.
+//
+// A cache file is a CacheHeader followed by sections. Each pool is stored
+// as its raw records, so the file can be mapped and used in place. Section
+// offsets are from the start of the file, strings and atom names are
+// (offset, length) pairs into the byte section, and atoms in the pools are
+// renumbered through the atom names on load. Sections are 8-aligned and
+// everything is in host byte order.
+
+#define CACHE_MAGIC "CODAAST"
+#define CACHE_VERSION 1
+
+typedef enum {
+    CACHE_EXPRS,
+    CACHE_STMTS,
+    CACHE_TYPES,
+    CACHE_ATTRS,
+    CACHE_VARS,
+    CACHE_FNS,
+    CACHE_AGGREGATES,
+    CACHE_INCLUDES,
+    CACHE_DECLS,
+    CACHE_LISTS,
+    CACHE_NUMBERS,
+    CACHE_STRINGS,      // CacheString records
+    CACHE_ATOMS,        // CacheString records, the name of each atom
+    CACHE_BYTES,
+    CACHE_SECTION_COUNT
+} CacheSection;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t length;
+} CacheString;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t count;     // records, bytes for CACHE_BYTES
+} CacheSectionEntry;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t section_count;
+    uint64_t source_hash;
+    uint64_t source_length;
+    Atom module_name;
+    uint32_t module_offset;
+    CacheSectionEntry sections[CACHE_SECTION_COUNT];
+} CacheHeader;
+
+uint64_t cache_hash(String contents);
+
+// Where the entry for a source with this hash lives inside `dir`; malloc'd
+char *cache_path(char *dir, uint64_t hash);
+
+// Writes `ast` of a `length` byte source to `path`, through a temporary
+// file and a rename so concurrent compiles never see half a file. Returns
+// false on I/O errors.
+bool cache_store(char *path, CompactAst *ast, uint64_t hash, size_t length);
+
+// Maps the entry at `path` into `out` if it exists, is well formed and was
+// made from the same source. Release it with compact_free().
+bool cache_load(char *path, uint64_t hash, size_t length, CompactAst *out);
+
+#endif
@@ -1,6 +1,9 @@
 #include <stdio.h>
+#include <string.h>
+#include <setjmp.h>
 #include "lexer.h"
 #include "parser.h"
+#include "error.h"
 
 // fprintf(stderr, "%.*s", len, str); to print String structures!
 
@@ -10,8 +13,9 @@ INSTANTIATE(char, ARRAY_TEMPLATE)
 static Source err_source = {0};
 
 static token_optional peek(Parser *ctx) {
-    if (ctx->index >= ctx->tokens.len) return (token_optional){};
-    return (token_optional){true, ctx->tokens.data[ctx->index]};
+    const Token *t = parser_current(ctx);
+    if (t->type == TOKENTYPE_EOF) return (token_optional){};
+    return (token_optional){true, *t};
 }
 
 #define BOLD_WHITE "\e[1;37m"
@@ -22,38 +26,36 @@ void error_set_source(Source source) {
     err_source = source;
 }
 
-__attribute__((noreturn)) void error_parser(Parser *ctx, const char *msg) {
-    token_optional t = peek(ctx);
-
-    if (!t.has_value) {
-        printf(BOLD_WHITE "%.*s:0:0: " RED "error: " RESET "%s\n" 
-               RED "error: " RESET "at end of file\n", 
-               err_source.path.length, err_source.path.data, msg);
-        exit(1);
-    }
+static void render_eof(FILE *out, const char *msg) {
+    fprintf(out, BOLD_WHITE "%.*s:0:0: " RED "error: " RESET "%s\n"
+            RED "error: " RESET "at end of file\n",
+            (int)err_source.path.length, err_source.path.data, msg);
+}
 
+static void render(FILE *out, size_t span_start, size_t span_len, const char *msg) {
     String file_view = err_source.contents;
-    size_t span_start = t.value.span.start;
-    size_t span_len = t.value.span.length;
-
-    size_t line_start = span_start;
-    while (line_start > 0 && file_view.data[line_start - 1] != '\n') --line_start;
-    size_t line_end = span_start;
-    while (line_end < file_view.length && file_view.data[line_end] != '\n') ++line_end;
 
-    String line_view = (String){
-        .data = file_view.data + line_start,
-        .length = line_end - line_start
-    };
-
-    size_t col = t.value.col ? t.value.col : (span_start - line_start + 1);
-
-    char_array printable_line = char_array_init();
-    char_array_resize(&printable_line, line_view.length);
-    for (size_t i = 0; i < line_view.length; i++) {
-        char c = line_view.data[i];
-        if (c == '\t') char_array_append(&printable_line, 4, ' ');
-        else char_array_push(&printable_line, c);
+    Position pos = source_position(&err_source, span_start);
+    String line_view = source_line(&err_source, pos.line);
+    size_t line_start = line_view.data - file_view.data;
+    size_t line_end = line_start + line_view.length;
+    size_t col = pos.col;
+
+    Arena *scratch = arena_scratch();
+    ArenaMark mark = arena_mark(scratch);
+
+    // Copied a run of non-tabs at a time, with each tab as four spaces
+    char_array printable_line = char_array_init_in(scratch);
+    char_array_reserve(&printable_line, line_view.length + 1);
+    for (size_t i = 0; i < line_view.length;) {
+        char *tab = memchr(line_view.data + i, '\t', line_view.length - i);
+        size_t run = tab ? (size_t)(tab - line_view.data) - i : line_view.length - i;
+        char_array_extend(&printable_line, line_view.data + i, run);
+        i += run;
+        if (tab) {
+            char_array_append(&printable_line, 4, ' ');
+            i++;
+        }
     }
     char_array_push(&printable_line, '\0');
 
@@ -76,103 +78,108 @@ __attribute__((noreturn)) void error_parser(Parser *ctx, const char *msg) {
         caret_len = cols > 1 ? cols : 1;
     }
 
-    printf(BOLD_WHITE "%.*s:%ld:%ld: " RED "error: " RESET "%s\n", err_source.path.length, err_source.path.data, t.value.line, col, msg);
+    fprintf(out, BOLD_WHITE "%.*s:%ld:%ld: " RED "error: " RESET "%s\n", (int)err_source.path.length, err_source.path.data, pos.line, col, msg);
 
-    printf("%ld | %s\n", t.value.line, printable_line.data);
+    fprintf(out, "%ld | %s\n", pos.line, printable_line.data);
 
-    size_t line_num_len = snprintf(NULL, 0, "%ld", t.value.line);
+    size_t line_num_len = snprintf(NULL, 0, "%ld", pos.line);
 
-    char_array underline = char_array_init();
+    static const char gutter[] = " | " RED;
+    char_array underline = char_array_init_in(scratch);
     char_array_append(&underline, line_num_len, ' ');
-    char_array_push(&underline, ' ');
-    char_array_push(&underline, '|');
-    char_array_push(&underline, ' ');
-    char_array_push(&underline, '\e');
-    char_array_push(&underline, '[');
-    char_array_push(&underline, '1');
-    char_array_push(&underline, ';');
-    char_array_push(&underline, '3');
-    char_array_push(&underline, '1');
-    char_array_push(&underline, 'm');
+    char_array_extend(&underline, gutter, sizeof(gutter) - 1);
     char_array_append(&underline, caret_pos, ' ');
     char_array_push(&underline, '^');
     char_array_append(&underline, caret_len - 1, '~');
     char_array_push(&underline, '\0');
 
-    printf("%s" RESET "\n", underline.data);
+    fprintf(out, "%s" RESET "\n", underline.data);
 
-    exit(1);
+    arena_reset_to(scratch, mark);
 }
 
-__attribute__((noreturn)) void error_sema(Token t, const char *msg) {
-    String file_view = err_source.contents;
-    size_t span_start = t.span.start;
-    size_t span_len = t.span.length;
-
-    size_t line_start = span_start;
-    while (line_start > 0 && file_view.data[line_start - 1] != '\n') --line_start;
-    size_t line_end = span_start;
-    while (line_end < file_view.length && file_view.data[line_end] != '\n') ++line_end;
-
-    String line_view = (String){
-        .data = file_view.data + line_start,
-        .length = line_end - line_start
+Diagnostics diagnostics_init(size_t max, bool echo) {
+    return (Diagnostics){
+        .items = diagnostic_array_init(),
+        .max = max ? max : 1,
+        .echo = echo,
     };
+}
 
-    size_t col = t.col ? t.col : (span_start - line_start + 1);
-
-    char_array printable_line = char_array_init();
-    char_array_resize(&printable_line, line_view.length);
-    for (size_t i = 0; i < line_view.length; i++) {
-        char c = line_view.data[i];
-        if (c == '\t') char_array_append(&printable_line, 4, ' ');
-        else char_array_push(&printable_line, c);
+void diagnostics_print(Diagnostics *diags) {
+    for (size_t i = 0; i < diags->items.len; i++) {
+        String text = diags->items.data[i].text;
+        fwrite(text.data, 1, text.length, stdout);
     }
-    char_array_push(&printable_line, '\0');
+}
 
-    size_t caret_pos = 0;
-    for (size_t i = 0; i < (span_start - line_start); i++) {
-        if (file_view.data[line_start + i] == '\t') {
-            caret_pos += 4;
-        } else {
-            caret_pos++;
-        }
+void diagnostics_free(Diagnostics *diags) {
+    for (size_t i = 0; i < diags->items.len; i++) {
+        free(diags->items.data[i].text.data);
     }
+    diagnostic_array_free(&diags->items);
+}
 
-    size_t caret_len = 1;
-    if (span_len > 0) {
-        size_t cols = 0;
-        for (size_t i = 0; i < span_len && (line_start + (span_start - line_start) + i) < line_end; i++) {
-            char c = file_view.data[span_start + i];
-            cols += (c == '\t') ? 4 : 1;
-        }
-        caret_len = cols > 1 ? cols : 1;
+__attribute__((noreturn)) void error_resume(Parser *ctx) {
+    Diagnostics *diags = ctx->diagnostics;
+    if (!ctx->recover) {
+        if (!diags->echo) diagnostics_print(diags);
+        exit(1);
     }
+    longjmp(*ctx->recover, 1);
+}
 
-    printf(BOLD_WHITE "%.*s:%ld:%ld: " RED "error: " RESET "%s\n", err_source.path.length, err_source.path.data, t.line, col, msg);
+// Without a diagnostics buffer the first error is fatal. Otherwise it is
+// recorded and the parser unwinds to its innermost recovery point, which
+// resynchronises and carries on until the buffer is full. An error at the
+// same token as the one before is an echo of it, and is not recorded, but
+// still counts toward the cap so that a parser stuck on one token stops.
+__attribute__((noreturn)) void error_parser(Parser *ctx, const char *msg) {
+    token_optional t = peek(ctx);
+    Diagnostics *diags = ctx->diagnostics;
 
-    printf("%ld | %s\n", t.line, printable_line.data);
+    if (!diags) {
+        if (t.has_value) render(stdout, t.value.span.start, t.value.span.length, msg);
+        else render_eof(stdout, msg);
+        exit(1);
+    }
 
-    size_t line_num_len = snprintf(NULL, 0, "%ld", t.line);
+    size_t offset = t.has_value ? t.value.span.start : err_source.contents.length;
+    if (diags->items.len && diags->items.data[diags->items.len - 1].offset == offset) {
+        if (diags->items.len + ++diags->echoes >= diags->max) diags->stopped = true;
+        error_resume(ctx);
+    }
 
-    char_array underline = char_array_init();
-    char_array_append(&underline, line_num_len, ' ');
-    char_array_push(&underline, ' ');
-    char_array_push(&underline, '|');
-    char_array_push(&underline, ' ');
-    char_array_push(&underline, '\e');
-    char_array_push(&underline, '[');
-    char_array_push(&underline, '1');
-    char_array_push(&underline, ';');
-    char_array_push(&underline, '3');
-    char_array_push(&underline, '1');
-    char_array_push(&underline, 'm');
-    char_array_append(&underline, caret_pos, ' ');
-    char_array_push(&underline, '^');
-    char_array_append(&underline, caret_len - 1, '~');
-    char_array_push(&underline, '\0');
+    // Rendering reads err_source, whose line index is built lazily and is
+    // not safe to share between threads
+    if (diags->offsets_only) {
+        diagnostic_array_push(&diags->items, (Diagnostic){ .offset = offset });
+        if (diags->items.len + diags->echoes >= diags->max) diags->stopped = true;
+        error_resume(ctx);
+    }
 
-    printf("%s" RESET "\n", underline.data);
+    char *text = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&text, &length);
+    if (!out) {
+        perror("open_memstream");
+        exit(1);
+    }
+    if (t.has_value) render(out, t.value.span.start, t.value.span.length, msg);
+    else render_eof(out, msg);
+    fclose(out);
+
+    diagnostic_array_push(&diags->items, (Diagnostic){
+        .text = { .data = text, .length = length },
+        .offset = offset,
+    });
+    if (diags->echo) fwrite(text, 1, length, stdout);
+    if (diags->items.len + diags->echoes >= diags->max) diags->stopped = true;
+
+    error_resume(ctx);
+}
 
+__attribute__((noreturn)) void error_sema(Token t, const char *msg) {
+    render(stdout, t.span.start, t.span.length, msg);
     exit(1);
 }
@@ -13,7 +13,31 @@
 
 void error_set_source(Source source);
 
-static char *format(char *msg, ...) {
+// A rendered syntax error, as printed
+typedef struct {
+    String text;
+    size_t offset;
+} Diagnostic;
+
+INSTANTIATE(Diagnostic, diagnostic, ARRAY_TEMPLATE)
+
+struct Diagnostics {
+    diagnostic_array items;
+    size_t max;         // parsing stops once this many are recorded or dropped
+    size_t echoes;      // errors dropped as echoes of the one before
+    bool stopped;
+    bool echo;          // print each one as it is recorded
+    bool offsets_only;  // record where each one is, but render no text
+};
+
+#define DIAGNOSTICS_DEFAULT_MAX 20
+
+Diagnostics diagnostics_init(size_t max, bool echo);
+void diagnostics_print(Diagnostics *diags);
+void diagnostics_free(Diagnostics *diags);
+
+__attribute__((format(printf, 1, 2)))
+static inline char *format(char *msg, ...) {
     char *buf;
     va_list args;
     va_start(args, msg);
@@ -23,6 +47,8 @@ static char *format(char *msg, ...) {
 }
 
 __attribute__((noreturn)) void error_parser(Parser *ctx, const char *msg);
+// Hands an error already recorded on to the next recovery point out
+__attribute__((noreturn)) void error_resume(Parser *ctx);
 __attribute__((noreturn)) void error_sema(Token t, const char *msg);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "intern.h"
+#include "arena.h"
+
+typedef struct {
+    String name;
+    uint32_t hash;
+} Entry;
+
+static struct {
+    Entry *entries;     // indexed by atom
+    size_t count;
+    size_t cap;
+
+    Atom *slots;        // open-addressed, 0 = empty
+    size_t slot_count;  // always a power of two
+
+    Arena *names;       // owns the bytes of every interned name
+} interner;
+
+static char *builtin_names[] = {
+    [ATOM_INT] = "int",
+    [ATOM_INT8] = "int8",
+    [ATOM_INT16] = "int16",
+    [ATOM_INT32] = "int32",
+    [ATOM_INT64] = "int64",
+    [ATOM_UINT] = "uint",
+    [ATOM_UINT8] = "uint8",
+    [ATOM_UINT16] = "uint16",
+    [ATOM_UINT32] = "uint32",
+    [ATOM_UINT64] = "uint64",
+    [ATOM_FLOAT] = "float",
+    [ATOM_CHAR] = "char",
+    [ATOM_STRING] = "string",
+    [ATOM_BOOL] = "bool",
+    [ATOM_NONE] = "none",
+};
+
+static uint32_t hash_string(String s) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < s.length; i++) {
+        h ^= (unsigned char)s.data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void grow_slots(void) {
+    size_t slot_count = interner.slot_count ? interner.slot_count * 2 : 1024;
+    Atom *slots = calloc(slot_count, sizeof(Atom));
+    if (!slots) {
+        fprintf(stderr, "intern: calloc failed\n");
+        exit(1);
+    }
+
+    for (Atom a = 1; a < interner.count; a++) {
+        size_t i = interner.entries[a].hash & (slot_count - 1);
+        while (slots[i]) i = (i + 1) & (slot_count - 1);
+        slots[i] = a;
+    }
+
+    if (mem_stats_on) {
+        mem_count_heap(0, slot_count * sizeof(Atom));
+        mem_count_heap(interner.slot_count * sizeof(Atom), 0);
+    }
+    free(interner.slots);
+    interner.slots = slots;
+    interner.slot_count = slot_count;
+}
+
+static Atom push_entry(String name, uint32_t hash) {
+    if (interner.count == interner.cap) {
+        size_t cap = interner.cap ? interner.cap * 2 : 256;
+        if (mem_stats_on) mem_count_heap(interner.cap * sizeof(Entry), cap * sizeof(Entry));
+        interner.cap = cap;
+        interner.entries = realloc(interner.entries, interner.cap * sizeof(Entry));
+        if (!interner.entries) {
+            fprintf(stderr, "intern: realloc failed\n");
+            exit(1);
+        }
+    }
+
+    interner.entries[interner.count] = (Entry){ .name = name, .hash = hash };
+    return interner.count++;
+}
+
+static Atom lookup_or_insert(String name) {
+    uint32_t hash = hash_string(name);
+    size_t mask = interner.slot_count - 1;
+    size_t i = hash & mask;
+
+    while (interner.slots[i]) {
+        Entry *e = &interner.entries[interner.slots[i]];
+        if (e->hash == hash && string_eq(e->name, name)) {
+            return interner.slots[i];
+        }
+        i = (i + 1) & mask;
+    }
+
+    // Copied, so atoms outlive the buffer they were lexed from (sources get
+    // replaced when edited)
+    char *bytes = arena_new_array(interner.names, char, name.length ? name.length : 1);
+    memcpy(bytes, name.data, name.length);
+
+    Atom a = push_entry((String){ .data = bytes, .length = name.length }, hash);
+    interner.slots[i] = a;
+
+    // keep the load factor under one half
+    if (interner.count * 2 > interner.slot_count) {
+        grow_slots();
+    }
+    return a;
+}
+
+static void intern_init(void) {
+    interner.names = arena_create();
+    push_entry((String){ .data = "", .length = 0 }, 0);  // ATOM_EMPTY, never slotted
+    grow_slots();
+
+    for (Atom a = ATOM_INT; a < ATOM_BUILTIN_COUNT; a++) {
+        lookup_or_insert(string_make(builtin_names[a]));
+    }
+}
+
+// The name is copied on first sight; the caller's bytes need not outlive the call
+Atom intern(String name) {
+    if (!interner.slots) {
+        intern_init();
+    }
+    return lookup_or_insert(name);
+}
+
+String atom_string(Atom atom) {
+    if (atom >= interner.count) {
+        return (String){ .data = "", .length = 0 };
+    }
+    return interner.entries[atom].name;
+}
+
+size_t atom_count(void) {
+    if (!interner.slots) {
+        intern_init();
+    }
+    return interner.count;
+}
@@ -0,0 +1,38 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stdint.h>
+#include "string.h"
+
+// Every distinct identifier maps to one Atom, so names compare as integers.
+// Atom 0 is never handed out and marks "no name".
+typedef uint32_t Atom;
+
+// Builtin type names are interned first, in this order, so their atoms are
+// compile-time constants
+typedef enum {
+    ATOM_EMPTY = 0,
+    ATOM_INT,
+    ATOM_INT8,
+    ATOM_INT16,
+    ATOM_INT32,
+    ATOM_INT64,
+    ATOM_UINT,
+    ATOM_UINT8,
+    ATOM_UINT16,
+    ATOM_UINT32,
+    ATOM_UINT64,
+    ATOM_FLOAT,
+    ATOM_CHAR,
+    ATOM_STRING,
+    ATOM_BOOL,
+    ATOM_NONE,
+    ATOM_BUILTIN_COUNT
+} BuiltinAtom;
+
+Atom intern(String name);
+String atom_string(Atom atom);
+// Atoms handed out so far, ATOM_EMPTY included; atoms are below this
+size_t atom_count(void);
+
+#endif
@@ -1,10 +1,16 @@
 #include <ctype.h>
+#include <math.h>
+#include <stdarg.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "lexer.h"
 #include "optional.h"
 #include "string.h"
+#include "scan.h"
+
+_Static_assert(SOURCE_PADDING >= SCAN_OVERREAD, "source padding must cover scanner over-read");
 
-INSTANTIATE(char, char, ARRAY_TEMPLATE)
 INSTANTIATE(char, char, OPTIONAL_TEMPLATE)
 
 static char_optional peek(Lexer *ctx) {
@@ -15,174 +21,503 @@ static char_optional peek(Lexer *ctx) {
 }
 
 static char consume(Lexer *ctx) {
-    char c = string_at(ctx->source.contents, ctx->source.index++);
-    if (c == '\n') {
-        ctx->line++;
-        ctx->col = 1;
-    } else {
-        ctx->col++;
-    }
+    return string_at(ctx->source.contents, ctx->source.index++);
+}
 
-    return c;
+static char *cursor(Lexer *ctx) {
+    return ctx->source.contents.data + ctx->source.index;
 }
 
-typedef struct {
-    char *name;
-    TokenType type;
-} Keyword;
-
-static Keyword keywords[] = {
-    {"module", TOKENTYPE_MODULE},
-    {"include", TOKENTYPE_INCLUDE},
-    {"fn", TOKENTYPE_FN},
-    {"return", TOKENTYPE_RETURN},
-    {"struct", TOKENTYPE_STRUCT},
-    {"union", TOKENTYPE_UNION},
-    {"enum", TOKENTYPE_ENUM},
-    {"type", TOKENTYPE_TYPE},
-    {"mut", TOKENTYPE_MUT},
-    {"if", TOKENTYPE_IF},
-    {"else", TOKENTYPE_ELSE},
-    {"for", TOKENTYPE_FOR},
-    {"while", TOKENTYPE_WHILE},
-    {"break", TOKENTYPE_BREAK},
-    {"continue", TOKENTYPE_CONTINUE},
-    {"true", TOKENTYPE_TRUE},
-    {"false", TOKENTYPE_FALSE},
-    {"null", TOKENTYPE_NULL}
-};
+static size_t remaining(Lexer *ctx) {
+    if (ctx->source.index >= ctx->source.contents.length) return 0;
+    return ctx->source.contents.length - ctx->source.index;
+}
 
-static Token decode_ident(Lexer *ctx, char_array *buf) {
-    for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
-        Keyword *k = keywords + i;
-        if (strcmp(buf->data, k->name) == 0) {
-            return (Token){ .type = k->type };
+// Skips n bytes that a bulk scanner already classified
+static void skip(Lexer *ctx, size_t n) {
+    ctx->source.index += n;
+}
+
+__attribute__((noreturn, format(printf, 2, 3)))
+static void lex_error(Lexer *ctx, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    if (ctx->recover) {
+        if (vasprintf(&ctx->error, fmt, args) == -1) ctx->error = NULL;
+        va_end(args);
+        longjmp(*ctx->recover, 1);
+    }
+    vprintf(fmt, args); //TODO: nice errors
+    va_end(args);
+    exit(1);
+}
+
+#define KEYWORD(str, tok) if (memcmp(text, str, length) == 0) return tok
+
+TokenType keyword_lookup(const char *text, size_t length) {
+    switch (length) {
+        case 2: {
+            switch (text[0]) {
+                case 'f': KEYWORD("fn", TOKENTYPE_FN); break;
+                case 'i': KEYWORD("if", TOKENTYPE_IF); break;
+            }
+            break;
+        }
+        case 3: {
+            switch (text[0]) {
+                case 'm': KEYWORD("mut", TOKENTYPE_MUT); break;
+                case 'f': KEYWORD("for", TOKENTYPE_FOR); break;
+            }
+            break;
+        }
+        case 4: {
+            switch (text[0]) {
+                case 'e': KEYWORD("else", TOKENTYPE_ELSE); KEYWORD("enum", TOKENTYPE_ENUM); break;
+                case 'n': KEYWORD("null", TOKENTYPE_NULL); break;
+                case 't': KEYWORD("type", TOKENTYPE_TYPE); KEYWORD("true", TOKENTYPE_TRUE); break;
+            }
+            break;
+        }
+        case 5: {
+            switch (text[0]) {
+                case 'b': KEYWORD("break", TOKENTYPE_BREAK); break;
+                case 'f': KEYWORD("false", TOKENTYPE_FALSE); break;
+                case 'u': KEYWORD("union", TOKENTYPE_UNION); break;
+                case 'w': KEYWORD("while", TOKENTYPE_WHILE); break;
+            }
+            break;
+        }
+        case 6: {
+            switch (text[0]) {
+                case 'm': KEYWORD("module", TOKENTYPE_MODULE); break;
+                case 'r': KEYWORD("return", TOKENTYPE_RETURN); break;
+                case 's': KEYWORD("struct", TOKENTYPE_STRUCT); break;
+            }
+            break;
         }
+        case 7: KEYWORD("include", TOKENTYPE_INCLUDE); break;
+        case 8: KEYWORD("continue", TOKENTYPE_CONTINUE); break;
     }
 
-    char *type_name = arena_strdup(ctx->arena, buf->data);
-    String name_str = { .data = type_name, .length = strlen(type_name) };
-    return (Token){ .type = TOKENTYPE_IDENT, .value = (string_optional){true, name_str} };
+    return TOKENTYPE_IDENT;
+}
+
+#undef KEYWORD
+
+static Token decode_ident(Lexer *ctx, size_t start, size_t length) {
+    char *text = ctx->source.contents.data + start;
+
+    TokenType type = keyword_lookup(text, length);
+    if (type != TOKENTYPE_IDENT) {
+        return (Token){ .type = type };
+    }
+
+    String name_str = { .data = text, .length = length };
+    Atom atom = ctx->defer_atoms ? ATOM_EMPTY : intern(name_str);
+    return (Token){ .type = TOKENTYPE_IDENT, .value = (string_optional){true, name_str}, .atom = atom };
+}
+
+// Backing storage for escapes whose value never appears in the source text,
+// so decoded char literals can still point at a stable byte
+static char escape_values[] = "\n\t\r\b";
+
+static char escape_char(char c) {
+    switch (c) {
+        case 'n': return '\n';
+        case 't': return '\t';
+        case 'r': return '\r';
+        case 'b': return '\b';
+        case '"': return '\"';
+        case '\'': return '\'';
+        case '\\': return '\\';
+        default: return c;
+    }
 }
 
 static char decode_esc(Lexer *ctx) {
     if (peek(ctx).has_value && peek(ctx).value == '\\') {
         consume(ctx);
         if (!peek(ctx).has_value) return 0xFF;
-        char c = consume(ctx);
-        switch (c) {
-            case 'n': return '\n';
-            case 't': return '\t';
-            case 'r': return '\r';
-            case 'b': return '\b';
-            case '"': return '\"';
-            case '\'': return '\'';
-            case '\\': return '\\';
-            default: return c;
-        }
+        return escape_char(consume(ctx));
     } else {
         return consume(ctx);
     }
 }
 
-token_array lex(Lexer *ctx) {
-    if (!ctx) return token_array_empty;
-    if (!ctx->source.contents.data) return token_array_empty;
-    if (!ctx->arena) return token_array_empty;
+// Only called for string bodies that contain a backslash; everything else
+// is handed out as a slice of the source
+static String decode_string(Lexer *ctx, String raw) {
+    char *out = arena_new_array(ctx->arena, char, raw.length);
+    size_t len = 0;
+
+    for (size_t i = 0; i < raw.length; i++) {
+        char c = raw.data[i];
+        if (c == '\\' && i + 1 < raw.length) {
+            c = escape_char(raw.data[++i]);
+        }
+        out[len++] = c;
+    }
+
+    return (String){ .data = out, .length = len };
+}
+
+static unsigned digit_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'z') return c - 'a' + 10;
+    return 36;
+}
 
-    token_array tokens = token_array_init();
-    char_array buffer = char_array_init();
+// Reads digits of the given base, and '_' separators between them, into
+// *value. Starts at a digit. Returns false if the value overflowed 64 bits.
+static bool read_digits(Lexer *ctx, unsigned base, uint64_t *value) {
+    bool ok = true;
+
+    // Plain decimal runs go through the bulk scanner
+    if (base == 10) {
+        size_t run = scan_digits(cursor(ctx), remaining(ctx));
+        for (size_t i = 0; i < run; i++) {
+            unsigned d = cursor(ctx)[i] - '0';
+            ok = ok && !__builtin_mul_overflow(*value, 10, value) && !__builtin_add_overflow(*value, d, value);
+        }
+        skip(ctx, run);
+    }
+
+    while (peek(ctx).has_value) {
+        char c = peek(ctx).value;
+        if (c == '_') {
+            if (remaining(ctx) < 2 || digit_value(cursor(ctx)[1]) >= base) {
+                lex_error(ctx, "Separator '_' must be between two digits\n");
+            }
+            consume(ctx);
+            continue;
+        }
+        unsigned d = digit_value(c);
+        if (d >= base) break;
+        consume(ctx);
+        ok = ok && !__builtin_mul_overflow(*value, base, value) && !__builtin_add_overflow(*value, d, value);
+    }
+
+    return ok;
+}
+
+// How far past the end of a token the lexer may have looked: "1e+5" only
+// becomes one token once the digit after the sign is seen
+#define LEX_LOOKAHEAD 3
+
+static bool at_digit(Lexer *ctx, size_t offset) {
+    return remaining(ctx) > offset && isdigit((unsigned char)cursor(ctx)[offset]);
+}
 
+// Integers: decimal, 0x, 0b, 0o, with '_' separators between digits, up to
+// INT64_MAX. Floats: decimal with a fraction and/or exponent.
+static Token decode_number(Lexer *ctx, size_t start) {
+    unsigned base = 10;
+    char *p = cursor(ctx);
+    if (p[0] == '0' && remaining(ctx) > 1) {
+        switch (p[1] | 0x20) {
+            case 'x': base = 16; break;
+            case 'b': base = 2; break;
+            case 'o': base = 8; break;
+        }
+    }
+
+    uint64_t value = 0;
+    bool ok;
+    bool is_float = false;
+    if (base != 10) {
+        skip(ctx, 2);
+        if (!peek(ctx).has_value || digit_value(peek(ctx).value) >= base) {
+            lex_error(ctx, "Expected digits after '%.2s'\n", p);
+        }
+        ok = read_digits(ctx, base, &value);
+    } else {
+        ok = read_digits(ctx, 10, &value);
+
+        if (peek(ctx).has_value && peek(ctx).value == '.' && at_digit(ctx, 1)) {
+            is_float = true;
+            consume(ctx);
+            uint64_t ignored = 0;
+            read_digits(ctx, 10, &ignored);
+        }
+        if (peek(ctx).has_value && (peek(ctx).value | 0x20) == 'e') {
+            char sign = remaining(ctx) > 1 ? cursor(ctx)[1] : 0;
+            size_t digit_at = (sign == '+' || sign == '-') ? 2 : 1;
+            if (at_digit(ctx, digit_at)) {
+                is_float = true;
+                skip(ctx, digit_at);
+                uint64_t ignored = 0;
+                read_digits(ctx, 10, &ignored);
+            }
+        }
+    }
+
+    if (peek(ctx).has_value && (isalnum((unsigned char)peek(ctx).value))) {
+        lex_error(ctx, "Invalid character '%c' in number literal\n", peek(ctx).value);
+    }
+
+    String num_string = { .data = ctx->source.contents.data + start, .length = ctx->source.index - start };
+
+    if (!is_float) {
+        if (!ok || value > INT64_MAX) {
+            lex_error(ctx, "Integer literal '%.*s' does not fit in a signed 64-bit integer\n", (int)num_string.length, num_string.data);
+        }
+        return (Token){ .type = TOKENTYPE_INT_LIT, .value = (string_optional){true, num_string}, .number._int = value };
+    }
+
+    // strtod wants a terminated string without separators
+    char small[64];
+    char *text = num_string.length < sizeof(small) ? small : arena_new_array(ctx->arena, char, num_string.length + 1);
+    size_t len = 0;
+    for (size_t i = 0; i < num_string.length; i++) {
+        if (num_string.data[i] != '_') text[len++] = num_string.data[i];
+    }
+    text[len] = '\0';
+
+    double d = strtod(text, NULL);
+    if (isinf(d)) {
+        lex_error(ctx, "Float literal '%.*s' is out of range\n", (int)num_string.length, num_string.data);
+    }
+    return (Token){ .type = TOKENTYPE_FLOAT_LIT, .value = (string_optional){true, num_string}, .number._float = d };
+}
+
+// Source width of every token kind whose spelling is fixed
+static const uint8_t token_widths[] = {
+    [TOKENTYPE_MODULE] = 6, [TOKENTYPE_INCLUDE] = 7, [TOKENTYPE_FN] = 2,
+    [TOKENTYPE_RETURN] = 6, [TOKENTYPE_STRUCT] = 6, [TOKENTYPE_UNION] = 5,
+    [TOKENTYPE_ENUM] = 4, [TOKENTYPE_TYPE] = 4, [TOKENTYPE_AT] = 1,
+    [TOKENTYPE_MUT] = 3, [TOKENTYPE_IF] = 2, [TOKENTYPE_ELSE] = 4,
+    [TOKENTYPE_FOR] = 3, [TOKENTYPE_WHILE] = 5, [TOKENTYPE_BREAK] = 5,
+    [TOKENTYPE_CONTINUE] = 8, [TOKENTYPE_TRUE] = 4, [TOKENTYPE_FALSE] = 5,
+    [TOKENTYPE_NULL] = 4, [TOKENTYPE_LPAREN] = 1, [TOKENTYPE_RPAREN] = 1,
+    [TOKENTYPE_LBRACE] = 1, [TOKENTYPE_RBRACE] = 1, [TOKENTYPE_LBRACK] = 1,
+    [TOKENTYPE_RBRACK] = 1, [TOKENTYPE_COLON] = 1, [TOKENTYPE_SEMICOLON] = 1,
+    [TOKENTYPE_DOUBLECOLON] = 2, [TOKENTYPE_COMMA] = 1, [TOKENTYPE_DOT] = 1,
+    [TOKENTYPE_AMP] = 1, [TOKENTYPE_QUESTION] = 1, [TOKENTYPE_NOT] = 1,
+    [TOKENTYPE_CARET] = 1, [TOKENTYPE_PERCENT] = 1, [TOKENTYPE_PIPE] = 1,
+    [TOKENTYPE_PLUS] = 1, [TOKENTYPE_MINUS] = 1, [TOKENTYPE_STAR] = 1,
+    [TOKENTYPE_SLASH] = 1, [TOKENTYPE_SHR] = 2, [TOKENTYPE_SHL] = 2,
+    [TOKENTYPE_GT] = 1, [TOKENTYPE_LT] = 1, [TOKENTYPE_EQEQ] = 2,
+    [TOKENTYPE_NEQ] = 2, [TOKENTYPE_GE] = 2, [TOKENTYPE_LE] = 2,
+    [TOKENTYPE_AMPAMP] = 2, [TOKENTYPE_PIPEPIPE] = 2, [TOKENTYPE_EQ] = 1,
+    [TOKENTYPE_PLUSEQ] = 2, [TOKENTYPE_MINUSEQ] = 2, [TOKENTYPE_STAREQ] = 2,
+    [TOKENTYPE_SLASHEQ] = 2, [TOKENTYPE_SHREQ] = 3, [TOKENTYPE_SHLEQ] = 3,
+    [TOKENTYPE_EOF] = 0,
+};
+
+token_array token_array_init(char *source) {
+    token_array v = {};
+    v.payloads = payload_array_init();
+    v.free_payloads = size_array_init();
+    v.source = source;
+    v.alive = true;
+    return v;
+}
+
+// For --mem-stats: the three columns going from old_cap to new_cap tokens
+static void count_columns(size_t old_cap, size_t new_cap) {
+    if (!mem_stats_on) return;
+    mem_count_heap(old_cap * sizeof(uint8_t), new_cap * sizeof(uint8_t));
+    mem_count_heap(old_cap * sizeof(uint32_t), new_cap * sizeof(uint32_t));
+    mem_count_heap(old_cap * sizeof(uint32_t), new_cap * sizeof(uint32_t));
+}
+
+static void token_array_reserve(token_array *v, size_t cap) {
+    if (cap <= v->cap) return;
+
+    size_t new_cap = v->cap ? v->cap : 256;
+    while (new_cap < cap) new_cap *= 2;
+
+    count_columns(v->cap, new_cap);
+    v->cap = new_cap;
+    v->kinds = realloc(v->kinds, v->cap * sizeof(uint8_t));
+    v->starts = realloc(v->starts, v->cap * sizeof(uint32_t));
+    v->aux = realloc(v->aux, v->cap * sizeof(uint32_t));
+    if (!v->kinds || !v->starts || !v->aux) {
+        fprintf(stderr, "token_array_reserve: realloc failed\n");
+        exit(1);
+    }
+}
+
+// Writes token into slot index, which must already be reserved
+static void token_array_set(token_array *v, size_t index, Token token) {
+    uint32_t aux = 0;
+    switch (token.type) {
+        case TOKENTYPE_IDENT: aux = token.atom; break;
+        case TOKENTYPE_INT_LIT:
+        case TOKENTYPE_FLOAT_LIT:
+        case TOKENTYPE_STR_LIT:
+        case TOKENTYPE_CHAR_LIT: {
+            TokenPayload p = {
+                .value = token.value.value,
+                .length = token.span.length,
+                .number = token.number,
+            };
+            // Source slices are kept as offsets, so they survive the source
+            // moving or the token shifting
+            char *span = v->source + token.span.start;
+            if (p.value.data >= span && p.value.data <= span + token.span.length) {
+                p.offset = p.value.data - span;
+                p.value.data = NULL;
+            }
+
+            if (v->free_payloads.len) {
+                aux = size_array_pop(&v->free_payloads);
+                v->payloads.data[aux] = p;
+            } else {
+                aux = v->payloads.len;
+                payload_array_push(&v->payloads, p);
+            }
+            break;
+        }
+        default: break;
+    }
+
+    v->kinds[index] = token.type;
+    v->starts[index] = token.span.start;
+    v->aux[index] = aux;
+}
+
+void token_array_push(token_array *v, Token token) {
+    if (!v->alive) {
+        fprintf(stderr, "token_array_push: uninitialised array\n");
+        exit(1);
+    }
+    token_array_reserve(v, v->len + 1);
+    token_array_set(v, v->len, token);
+    v->len++;
+}
+
+Token token_array_at(token_array *v, size_t index) {
+    if (index >= v->len) {
+        Token last = v->len ? token_array_at(v, v->len - 1) : (Token){};
+        return (Token){ .type = TOKENTYPE_EOF, .span = { .start = last.span.start + last.span.length } };
+    }
+
+    Token t = {
+        .type = v->kinds[index],
+        .span = { .start = v->starts[index] },
+    };
+    uint32_t aux = v->aux[index];
+
+    switch (t.type) {
+        case TOKENTYPE_IDENT: {
+            t.atom = aux;
+            t.span.length = atom_string(aux).length;
+            t.value = (string_optional){true, { .data = v->source + t.span.start, .length = t.span.length }};
+            break;
+        }
+        case TOKENTYPE_INT_LIT:
+        case TOKENTYPE_FLOAT_LIT:
+        case TOKENTYPE_STR_LIT:
+        case TOKENTYPE_CHAR_LIT: {
+            TokenPayload *p = &v->payloads.data[aux];
+            t.span.length = p->length;
+            t.value = (string_optional){true, p->value};
+            if (!p->value.data) t.value.value.data = v->source + t.span.start + p->offset;
+            t.number = p->number;
+            break;
+        }
+        default: {
+            t.span.length = token_widths[t.type];
+            break;
+        }
+    }
+
+    return t;
+}
+
+void token_array_free(token_array *v) {
+    if (!v->alive) {
+        fprintf(stderr, "token_array_free: uninitialised array\n");
+        exit(1);
+    }
+    count_columns(v->cap, 0);
+    free(v->kinds);
+    free(v->starts);
+    free(v->aux);
+    payload_array_free(&v->payloads);
+    size_array_free(&v->free_payloads);
+    v->len = v->cap = 0;
+}
+
+Token lex_next(Lexer *ctx) {
     char_optional p = peek(ctx);
 
     while (p.has_value) {
-        char_array_clear(&buffer);
-
         size_t start = ctx->source.index;
 
         bool comment = false;
+        Token tok;
 
         if (isspace((unsigned char)p.value)) {
-            consume(ctx);
+            skip(ctx, scan_whitespace(cursor(ctx), remaining(ctx)));
             p = peek(ctx);
-            while (p.has_value && isspace((unsigned char)p.value)) {
-                consume(ctx);
-                p = peek(ctx);
-            }
-            
             continue;
         }
         
         if (isalpha((unsigned char)p.value)) {
-            char_array_push(&buffer, consume(ctx));
-            p = peek(ctx);
-            while (p.has_value && (isalpha((unsigned char)p.value) || p.value == '_')) {
-                char_array_push(&buffer, consume(ctx));
-                p = peek(ctx);
-            }
-
-            char_array_push(&buffer, '\0');
+            consume(ctx);
+            skip(ctx, scan_ident(cursor(ctx), remaining(ctx)));
 
-            token_array_push(&tokens, decode_ident(ctx, &buffer));
+            tok = decode_ident(ctx, start, ctx->source.index - start);
         }
         else if (isdigit((unsigned char)p.value)) {
-            char_array_push(&buffer, consume(ctx));
-            p = peek(ctx);
-            while (p.has_value && isdigit((unsigned char)p.value)) {
-                char_array_push(&buffer, consume(ctx));
-                p = peek(ctx);
-            }
-            
-            char_array_push(&buffer, '\0');
-
-            char *num_str = arena_strdup(ctx->arena, buffer.data);
-            String num_string = { .data = num_str, .length = strlen(num_str) };
-            token_array_push(&tokens, (Token){ .type = TOKENTYPE_INT_LIT, .value = (string_optional){true, num_string} });
+            tok = decode_number(ctx, start);
         }
         else {
             char c = consume(ctx);
             switch (c) {
                 case '@': {
-                    token_array_push(&tokens, (Token){ .type = TOKENTYPE_AT });
+                    tok = (Token){ .type = TOKENTYPE_AT };
                     break;
                 }
                 case '\'': {
                     char c = decode_esc(ctx);
                     if (!peek(ctx).has_value || peek(ctx).value != '\'') {
-                        printf("Unterminated character literal\n"); //TODO: nice errors
-                        exit(1);
+                        lex_error(ctx, "Unterminated character literal\n");
                     }
                     consume(ctx);
-                    char *char_str = arena_strdup(ctx->arena, (char[]){c, '\0'});
-                    String char_string = { .data = char_str, .length = 1 };
-                    token_array_push(&tokens, (Token){ .type = TOKENTYPE_CHAR_LIT, .value = (string_optional){true, char_string}});
+                    char *value = ctx->source.contents.data + ctx->source.index - 2;
+                    if (*value != c) {
+                        value = strchr(escape_values, c);
+                    }
+                    String char_string = { .data = value, .length = 1 };
+                    tok = (Token){ .type = TOKENTYPE_CHAR_LIT, .value = (string_optional){true, char_string}};
                     break;
                 }
                 case '"': {
-                    while (peek(ctx).has_value && peek(ctx).value != '"') {
-                        char_array_push(&buffer, decode_esc(ctx));
+                    size_t body = ctx->source.index;
+                    bool escaped = false;
+                    while (true) {
+                        skip(ctx, scan_string(cursor(ctx), remaining(ctx)));
+                        if (!peek(ctx).has_value || peek(ctx).value == '"') break;
+
+                        // backslash: skip it and whatever it escapes
+                        escaped = true;
+                        consume(ctx);
+                        if (!peek(ctx).has_value) break;
+                        consume(ctx);
                     }
-                    char_array_push(&buffer, '\0');
+                    String str_string = { .data = ctx->source.contents.data + body, .length = ctx->source.index - body };
                     consume(ctx);
-                    char *str = arena_strdup(ctx->arena, buffer.data);
-                    String str_string = { .data = str, .length = strlen(str) };
-                    token_array_push(&tokens, (Token){ .type = TOKENTYPE_STR_LIT, .value = (string_optional){true, str_string}});
-                    char_array_clear(&buffer);
+                    if (escaped) {
+                        str_string = decode_string(ctx, str_string);
+                    }
+                    tok = (Token){ .type = TOKENTYPE_STR_LIT, .value = (string_optional){true, str_string}};
                     break;
                 }
                 case '/': {
                     if (peek(ctx).has_value && peek(ctx).value == '/') {
                         consume(ctx);
-                        while (peek(ctx).has_value && peek(ctx).value != '\n') {
-                            consume(ctx);
-                            comment = true;
-                        }
+                        skip(ctx, scan_line(cursor(ctx), remaining(ctx)));
+                        comment = true;
                     } else {
                         if (peek(ctx).has_value && peek(ctx).value == '=') {
                             consume(ctx);
-                            token_array_push(&tokens, (Token){ .type = TOKENTYPE_SLASHEQ });
+                            tok = (Token){ .type = TOKENTYPE_SLASHEQ };
                         } else {
-                            token_array_push(&tokens, (Token){ .type = TOKENTYPE_SLASH });
+                            tok = (Token){ .type = TOKENTYPE_SLASH };
                         }
                     }
                     break;
@@ -190,81 +525,81 @@ token_array lex(Lexer *ctx) {
                 case ':': {
                     if (peek(ctx).has_value && peek(ctx).value == ':') {
                         consume(ctx);
-                        token_array_push(&tokens, (Token){ .type = TOKENTYPE_DOUBLECOLON });
+                        tok = (Token){ .type = TOKENTYPE_DOUBLECOLON };
                     } else {
-                        token_array_push(&tokens, (Token){ .type = TOKENTYPE_COLON });
+                        tok = (Token){ .type = TOKENTYPE_COLON };
                     }
                     break;
                 }
                 case '(': {
-                    token_array_push(&tokens, (Token){ .type = TOKENTYPE_LPAREN });
+                    tok = (Token){ .type = TOKENTYPE_LPAREN };
                     break;
                 }
                 case ')': {
-                    token_array_push(&tokens, (Token){ .type = TOKENTYPE_RPAREN });
+                    tok = (Token){ .type = TOKENTYPE_RPAREN };
                     break;
                 }
                 case '{': {
-                    token_array_push(&tokens, (Token){ .type = TOKENTYPE_LBRACE });
+                    tok = (Token){ .type = TOKENTYPE_LBRACE };
                     break;
                 }
                 case '}': {
-                    token_array_push(&tokens, (Token){ .type = TOKENTYPE_RBRACE });
+                    tok = (Token){ .type = TOKENTYPE_RBRACE };
                     break;
                 }
                 case '[': {
-                    token_array_push(&tokens, (Token){ .type = TOKENTYPE_LBRACK });
+                    tok = (Token){ .type = TOKENTYPE_LBRACK };
                     break;
                 }
                 case ']': {
-                    token_array_push(&tokens, (Token){ .type = TOKENTYPE_RBRACK });
+                    tok = (Token){ .type = TOKENTYPE_RBRACK };
                     break;
                 }
                 case ';': {
-                    token_array_push(&tokens, (Token){ .type = TOKENTYPE_SEMICOLON });
+                    tok = (Token){ .type = TOKENTYPE_SEMICOLON };
                     break;
                 }
                 case '&': {
-                    token_array_push(&tokens, (Token){ .type = TOKENTYPE_AMP });
+                    tok = (Token){ .type = TOKENTYPE_AMP };
                     break;
                 }
                 case '%': {
-                    token_array_push(&tokens, (Token){ .type = TOKENTYPE_PERCENT });
+                    tok = (Token){ .type = TOKENTYPE_PERCENT };
                     break;
                 }
                 case '+': {
                     if (peek(ctx).has_value && peek(ctx).value == '=') {
                         consume(ctx);
-                        token_array_push(&tokens, (Token){ .type = TOKENTYPE_PLUSEQ });
+                        tok = (Token){ .type = TOKENTYPE_PLUSEQ };
                     } else {
-                        token_array_push(&tokens, (Token){ .type = TOKENTYPE_PLUS });
+                        tok = (Token){ .type = TOKENTYPE_PLUS };
                     }
                     break;
                 }
                 case '!': {
                     if (peek(ctx).has_value && peek(ctx).value == '=') {
                         consume(ctx);
-                        token_array_push(&tokens, (Token){ .type = TOKENTYPE_NEQ });
+                        tok = (Token){ .type = TOKENTYPE_NEQ };
                     } else {
-                        token_array_push(&tokens, (Token){ .type = TOKENTYPE_NOT });
+                        tok = (Token){ .type = TOKENTYPE_NOT };
                     }
                     break;
                 }
                 case '-': {
                     if (peek(ctx).has_value && peek(ctx).value == '=') {
                         consume(ctx);
-                        token_array_push(&tokens, (Token){ .type = TOKENTYPE_MINUSEQ });
+                        tok = (Token){ .type = TOKENTYPE_MINUSEQ };
                     } else {
-                        token_array_push(&tokens, (Token){ .type = TOKENTYPE_MINUS });
+                        tok = (Token){ .type = TOKENTYPE_MINUS };
                     }
                     break;
                 }
                 case '*': {
                     if (peek(ctx).has_value && peek(ctx).value == '=') {
                         consume(ctx);
-                        token_array_push(&tokens, (Token){ .type = TOKENTYPE_STAREQ });
+                        tok = (Token){ .type = TOKENTYPE_STAREQ };
                     } else {
-                        token_array_push(&tokens, (Token){ .type = TOKENTYPE_STAR });
+                        tok = (Token){ .type = TOKENTYPE_STAR };
                     }
                     break;
                 }
@@ -273,15 +608,15 @@ token_array lex(Lexer *ctx) {
                         consume(ctx);
                         if (peek(ctx).has_value && peek(ctx).value == '=') {
                             consume(ctx);
-                            token_array_push(&tokens, (Token){ .type = TOKENTYPE_SHLEQ });
+                            tok = (Token){ .type = TOKENTYPE_SHLEQ };
                         } else {
-                            token_array_push(&tokens, (Token){ .type = TOKENTYPE_SHL });
+                            tok = (Token){ .type = TOKENTYPE_SHL };
                         }
                     } else if (peek(ctx).has_value && peek(ctx).value == '=') {
                         consume(ctx);
-                        token_array_push(&tokens, (Token){ .type = TOKENTYPE_LE });
+                        tok = (Token){ .type = TOKENTYPE_LE };
                     } else {
-                        token_array_push(&tokens, (Token){ .type = TOKENTYPE_LT });
+                        tok = (Token){ .type = TOKENTYPE_LT };
                     }
                     break;
                 }
@@ -290,56 +625,374 @@ token_array lex(Lexer *ctx) {
                         consume(ctx);
                         if (peek(ctx).has_value && peek(ctx).value == '=') {
                             consume(ctx);
-                            token_array_push(&tokens, (Token){ .type = TOKENTYPE_SHREQ });
+                            tok = (Token){ .type = TOKENTYPE_SHREQ };
                         } else {
-                            token_array_push(&tokens, (Token){ .type = TOKENTYPE_SHR });
+                            tok = (Token){ .type = TOKENTYPE_SHR };
                         }
                     } else if (peek(ctx).has_value && peek(ctx).value == '=') {
                         consume(ctx);
-                        token_array_push(&tokens, (Token){ .type = TOKENTYPE_GE });
+                        tok = (Token){ .type = TOKENTYPE_GE };
                     } else {
-                        token_array_push(&tokens, (Token){ .type = TOKENTYPE_GT });
+                        tok = (Token){ .type = TOKENTYPE_GT };
                     }
                     break;
                 }
                 case '=': {
                     if (peek(ctx).has_value && peek(ctx).value == '=') {
                         consume(ctx);
-                        token_array_push(&tokens, (Token){ .type = TOKENTYPE_EQEQ });
+                        tok = (Token){ .type = TOKENTYPE_EQEQ };
                     } else {
-                        token_array_push(&tokens, (Token){ .type = TOKENTYPE_EQ });
+                        tok = (Token){ .type = TOKENTYPE_EQ };
                     }
                     break;
                 }
                 case ',': {
-                    token_array_push(&tokens, (Token){ .type = TOKENTYPE_COMMA });
+                    tok = (Token){ .type = TOKENTYPE_COMMA };
                     break;
                 }
                 case '.': {
-                    token_array_push(&tokens, (Token){ .type = TOKENTYPE_DOT });
+                    tok = (Token){ .type = TOKENTYPE_DOT };
                     break;
                 }
                 case '?': {
-                    token_array_push(&tokens, (Token){ .type = TOKENTYPE_QUESTION });
+                    tok = (Token){ .type = TOKENTYPE_QUESTION };
                     break;
                 }
                 default: {
-                    printf("Unknown character 0x%02X\n", c);
-                    exit(1);
+                    lex_error(ctx, "Unknown character 0x%02X\n", c);
                 }
             }
         }
 
         if (!comment) {
-            Token *last = tokens.data + tokens.len - 1;
-            last->span = (Span){ .start = start, .length = ctx->source.index - start };
-            last->line = ctx->line;
-            last->col = ctx->col;
+            tok.span = (Span){ .start = start, .length = ctx->source.index - start };
+            return tok;
         }
 
         p = peek(ctx);
     }
 
+    return (Token){ .type = TOKENTYPE_EOF, .span = { .start = ctx->source.contents.length } };
+}
+
+token_array lex(Lexer *ctx) {
+    if (!ctx) return token_array_empty;
+    if (!ctx->source.contents.data) return token_array_empty;
+    if (!ctx->arena) return token_array_empty;
+
+    if (ctx->source.contents.length > UINT32_MAX) {
+        lex_error(ctx, "Source file too large (token offsets are 32-bit)\n");
+    }
+
+    token_array tokens = token_array_init(ctx->source.contents.data);
+
+    Token tok = lex_next(ctx);
+    while (tok.type != TOKENTYPE_EOF) {
+        token_array_push(&tokens, tok);
+        tok = lex_next(ctx);
+    }
+
     ctx->source.index = 0;
     return tokens;
-}
\ No newline at end of file
+}
+// Finds line starts where a chunk can begin with the lexer in its initial
+// state: outside string and char literals (comments end at the newline, so
+// they never straddle one). Only quotes, slashes and newlines are looked at.
+// Fills splits[0..] with ascending offsets, the first being 0, and returns
+// how many were found (at most chunks).
+static size_t find_splits(String src, size_t *splits, size_t chunks) {
+    const char *p = src.data;
+    size_t n = src.length;
+
+    size_t count = 0;
+    splits[count++] = 0;
+    size_t target = n / chunks;
+
+    size_t i = 0;
+    while (i < n && count < chunks) {
+        char c = p[i++];
+        switch (c) {
+            case '"': {
+                while (i < n) {
+                    i += scan_string(p + i, n - i);
+                    if (i >= n || p[i] == '"') break;
+                    i += 2;
+                }
+                i++;
+                break;
+            }
+            case '\'': {
+                i += (i < n && p[i] == '\\') ? 3 : 2;
+                break;
+            }
+            case '/': {
+                if (i < n && p[i] == '/') {
+                    i += scan_line(p + i, n - i);
+                }
+                break;
+            }
+            case '\n': {
+                if (i >= target) {
+                    splits[count++] = i;
+                    target = count * n / chunks;
+                }
+                break;
+            }
+        }
+    }
+
+    return count;
+}
+
+typedef struct {
+    Lexer lexer;
+    token_array tokens;
+    pthread_t thread;
+    bool failed;
+} LexChunk;
+
+// A lexer error ends the chunk with failed set and the message in
+// lexer.error; lex_parallel() reports it once every chunk is done
+static void *lex_chunk(void *arg) {
+    LexChunk *chunk = arg;
+
+    jmp_buf here;
+    if (setjmp(here) != 0) {
+        chunk->failed = true;
+        return NULL;
+    }
+    chunk->lexer.recover = &here;
+
+    Token tok = lex_next(&chunk->lexer);
+    while (tok.type != TOKENTYPE_EOF) {
+        // Until the chunks are stitched, an identifier's aux carries its length
+        if (tok.type == TOKENTYPE_IDENT) tok.atom = tok.span.length;
+        token_array_push(&chunk->tokens, tok);
+        tok = lex_next(&chunk->lexer);
+    }
+
+    return NULL;
+}
+
+// Appends a chunk's tokens. Starts are already absolute; identifiers are
+// interned here, in source order, and payload indices are rebased.
+static void stitch(token_array *out, token_array *chunk) {
+    size_t base = out->len;
+    uint32_t payload_base = out->payloads.len;
+
+    memcpy(out->kinds + base, chunk->kinds, chunk->len * sizeof(uint8_t));
+    memcpy(out->starts + base, chunk->starts, chunk->len * sizeof(uint32_t));
+    memcpy(out->aux + base, chunk->aux, chunk->len * sizeof(uint32_t));
+    out->len += chunk->len;
+
+    for (size_t i = base; i < out->len; i++) {
+        switch (out->kinds[i]) {
+            case TOKENTYPE_IDENT: {
+                out->aux[i] = intern((String){ .data = out->source + out->starts[i], .length = out->aux[i] });
+                break;
+            }
+            case TOKENTYPE_INT_LIT:
+            case TOKENTYPE_FLOAT_LIT:
+            case TOKENTYPE_STR_LIT:
+            case TOKENTYPE_CHAR_LIT: {
+                out->aux[i] += payload_base;
+                break;
+            }
+            default: break;
+        }
+    }
+
+    for (size_t i = 0; i < chunk->payloads.len; i++) {
+        payload_array_push(&out->payloads, chunk->payloads.data[i]);
+    }
+}
+
+token_array lex_parallel(Lexer *ctx, size_t threads) {
+    if (!ctx || !ctx->source.contents.data || !ctx->arena) return token_array_empty;
+
+    if (threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? cpus : 1;
+    }
+    size_t max_chunks = ctx->source.contents.length / LEX_PARALLEL_MIN_CHUNK;
+    if (threads > max_chunks) threads = max_chunks;
+    if (threads < 2) return lex(ctx);
+
+    if (ctx->source.contents.length > UINT32_MAX) {
+        lex_error(ctx, "Source file too large (token offsets are 32-bit)\n");
+    }
+
+    size_t *splits = malloc(threads * sizeof(size_t));
+    LexChunk *chunks = calloc(threads, sizeof(LexChunk));
+    if (!splits || !chunks) {
+        fprintf(stderr, "lex_parallel: allocation failed\n");
+        exit(1);
+    }
+
+    size_t count = find_splits(ctx->source.contents, splits, threads);
+
+    for (size_t i = 0; i < count; i++) {
+        LexChunk *chunk = &chunks[i];
+        size_t end = (i + 1 < count) ? splits[i + 1] : ctx->source.contents.length;
+
+        // Each chunk sees the source cut off at its end, so offsets stay absolute
+        chunk->lexer = *ctx;
+        chunk->lexer.source.contents.length = end;
+        chunk->lexer.source.index = splits[i];
+        chunk->lexer.arena = arena_create();
+        chunk->lexer.defer_atoms = true;
+        chunk->lexer.error = NULL;
+        chunk->tokens = token_array_init(ctx->source.contents.data);
+
+        if (pthread_create(&chunk->thread, NULL, lex_chunk, chunk) != 0) {
+            fprintf(stderr, "lex_parallel: pthread_create failed\n");
+            exit(1);
+        }
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        pthread_join(chunks[i].thread, NULL);
+        total += chunks[i].tokens.len;
+    }
+
+    // Each chunk stops at its first error, so the earliest failing chunk
+    // holds the first error in the file
+    for (size_t i = 0; i < count; i++) {
+        if (chunks[i].failed) {
+            fputs(chunks[i].lexer.error ? chunks[i].lexer.error : "Lexer error\n", stdout);
+            exit(1);
+        }
+    }
+
+    token_array tokens = token_array_init(ctx->source.contents.data);
+    tokens.cap = total;
+    tokens.kinds = malloc(total * sizeof(uint8_t));
+    tokens.starts = malloc(total * sizeof(uint32_t));
+    tokens.aux = malloc(total * sizeof(uint32_t));
+    if (total && (!tokens.kinds || !tokens.starts || !tokens.aux)) {
+        fprintf(stderr, "lex_parallel: allocation failed\n");
+        exit(1);
+    }
+    count_columns(0, total);
+
+    // Decoded string payloads point into the chunk arenas, so ctx's arena
+    // takes them over
+    for (size_t i = 0; i < count; i++) {
+        stitch(&tokens, &chunks[i].tokens);
+        token_array_free(&chunks[i].tokens);
+        arena_adopt(ctx->arena, chunks[i].lexer.arena);
+    }
+
+    free(splits);
+    free(chunks);
+    return tokens;
+}
+
+// First token starting at or after offset
+static size_t token_lower_bound(token_array *v, size_t offset) {
+    size_t lo = 0, hi = v->len;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (v->starts[mid] < offset) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static size_t token_end(token_array *v, size_t index) {
+    Token t = token_array_at(v, index);
+    return t.span.start + t.span.length;
+}
+
+TokenEdit relex(Lexer *ctx, token_array *tokens, size_t start, size_t end, String text) {
+    if (ctx->source.contents.length - (end - start) + text.length > UINT32_MAX) {
+        lex_error(ctx, "Source file too large (token offsets are 32-bit)\n");
+    }
+
+    size_t new_end = start + text.length;
+
+    source_replace(&ctx->source, start, end, text);
+    tokens->source = ctx->source.contents.data;
+
+    // A token can change if the edit starts within LEX_LOOKAHEAD bytes of
+    // its end: it may grow into the edit, or a number may gain a fraction or
+    // exponent past the '.', 'e' or sign that were lexed as tokens of their
+    // own. Relexing resumes at the end of the last token that is out of
+    // reach; the lexer is in its initial state right after any token.
+    size_t first = token_lower_bound(tokens, start);
+    while (first > 0 && token_end(tokens, first - 1) + LEX_LOOKAHEAD > start) first--;
+    size_t from = first > 0 ? token_end(tokens, first - 1) : 0;
+
+    // Old tokens from `old` on lie entirely after the edit. Once a relexed
+    // token starts where one of them now starts, the rest of the stream is
+    // unchanged and relexing stops.
+    size_t old = token_lower_bound(tokens, end);
+
+    Token *fresh = NULL;
+    size_t fresh_len = 0, fresh_cap = 0;
+
+    ctx->source.index = from;
+    Token tok = lex_next(ctx);
+    while (tok.type != TOKENTYPE_EOF) {
+        if (tok.span.start >= new_end) {
+            while (old < tokens->len && tokens->starts[old] - end + new_end < tok.span.start) old++;
+            if (old < tokens->len && tokens->starts[old] - end + new_end == tok.span.start) break;
+        }
+
+        if (fresh_len == fresh_cap) {
+            size_t new_cap = fresh_cap ? fresh_cap * 2 : 16;
+            if (mem_stats_on) mem_count_heap(fresh_cap * sizeof(Token), new_cap * sizeof(Token));
+            fresh_cap = new_cap;
+            fresh = realloc(fresh, fresh_cap * sizeof(Token));
+            if (!fresh) {
+                fprintf(stderr, "relex: realloc failed\n");
+                exit(1);
+            }
+        }
+        fresh[fresh_len++] = tok;
+        tok = lex_next(ctx);
+    }
+    if (tok.type == TOKENTYPE_EOF) old = tokens->len;
+    ctx->source.index = 0;
+
+    // The replaced tokens' payload slots go to the fresh tokens first
+    for (size_t i = first; i < old; i++) {
+        switch (tokens->kinds[i]) {
+            case TOKENTYPE_INT_LIT:
+            case TOKENTYPE_FLOAT_LIT:
+            case TOKENTYPE_STR_LIT:
+            case TOKENTYPE_CHAR_LIT: {
+                size_array_push(&tokens->free_payloads, tokens->aux[i]);
+                break;
+            }
+            default: break;
+        }
+    }
+
+    // Splice: [0, first) stays, [first, old) is replaced by the fresh tokens,
+    // [old, len) moves and has its starts shifted by the edit's size change
+    size_t tail = tokens->len - old;
+    size_t dest = first + fresh_len;
+    token_array_reserve(tokens, dest + tail);
+
+    if (dest != old) {
+        memmove(tokens->kinds + dest, tokens->kinds + old, tail * sizeof(uint8_t));
+        memmove(tokens->starts + dest, tokens->starts + old, tail * sizeof(uint32_t));
+        memmove(tokens->aux + dest, tokens->aux + old, tail * sizeof(uint32_t));
+    }
+    if (new_end != end) {
+        for (size_t i = dest; i < dest + tail; i++) {
+            tokens->starts[i] = tokens->starts[i] - end + new_end;
+        }
+    }
+
+    for (size_t i = 0; i < fresh_len; i++) {
+        token_array_set(tokens, first + i, fresh[i]);
+    }
+    tokens->len = dest + tail;
+
+    if (mem_stats_on) mem_count_heap(fresh_cap * sizeof(Token), 0);
+    free(fresh);
+    return (TokenEdit){ .first = first, .removed = old - first, .inserted = fresh_len };
+}
@@ -1,12 +1,16 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include <setjmp.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "array.h"
 #include "string.h"
 #include "optional.h"
 #include "arena.h"
+#include "intern.h"
+#include "source.h"
 
 typedef enum {
     TOKENTYPE_MODULE,
@@ -28,7 +32,8 @@ typedef enum {
     TOKENTYPE_CONTINUE,
     TOKENTYPE_STR_LIT,
     TOKENTYPE_CHAR_LIT,
-    TOKENTYPE_INT_LIT,    // TODO: more number literals maybe
+    TOKENTYPE_INT_LIT,
+    TOKENTYPE_FLOAT_LIT,
     TOKENTYPE_TRUE,
     TOKENTYPE_FALSE,
     TOKENTYPE_NULL,
@@ -79,28 +84,94 @@ typedef struct {
 
 INSTANTIATE(String, string, OPTIONAL_TEMPLATE)
 
+// Numeric literals are decoded once, by the lexer
+typedef union {
+    uint64_t _int;      // TOKENTYPE_INT_LIT
+    double _float;      // TOKENTYPE_FLOAT_LIT
+} NumberValue;
+
 typedef struct {
     TokenType type;
     string_optional value;
+    Atom atom;          // set for TOKENTYPE_IDENT
+    NumberValue number; // set for TOKENTYPE_INT_LIT and _FLOAT_LIT
     Span span;
-    size_t line, col;
 } Token;
 
-INSTANTIATE(Token, token, ARRAY_TEMPLATE)
+typedef struct {
+    String value;       // decoded text; data is NULL when it is a source slice
+    uint32_t length;    // span length in the source
+    uint32_t offset;    // where in the span a source slice starts
+    NumberValue number;
+} TokenPayload;
+
+INSTANTIATE(TokenPayload, payload, ARRAY_TEMPLATE)
 
+// Tokens are stored column-wise: the parser's lookahead only reads the dense
+// kind bytes, and a full Token is put back together by token_array_at().
+// What aux holds depends on the kind:
+//   TOKENTYPE_IDENT                  the identifier's atom
+//   TOKENTYPE_STR_LIT, _CHAR_LIT,
+//   TOKENTYPE_INT_LIT, _FLOAT_LIT    index into payloads
+//   anything else                    unused, the span width is fixed
 typedef struct {
-    String path;
-    String contents;
-    size_t index;
-} Source;
+    uint8_t *kinds;
+    uint32_t *starts;
+    uint32_t *aux;
+    payload_array payloads;
+    size_array free_payloads;   // slots left behind by tokens relex() replaced
+    char *source;       // Source.contents, which slices point into
+    size_t len;
+    size_t cap;
+    bool alive;
+} token_array;
+
+[[maybe_unused]] static token_array token_array_empty = {};
+
+token_array token_array_init(char *source);
+void token_array_push(token_array *v, Token token);
+Token token_array_at(token_array *v, size_t index);
+void token_array_free(token_array *v);
 
 typedef struct {
     Source source;
-    size_t line, col;
 
     Arena *arena;
+    bool defer_atoms;   // leave identifier atoms unset, lex_parallel() assigns them in order
+
+    // When set, an error formats its message into `error` and jumps here
+    // instead of printing it and exiting
+    jmp_buf *recover;
+    char *error;
 } Lexer;
 
+// Below this size lex_parallel() just calls lex()
+#define LEX_PARALLEL_MIN_CHUNK (256 * 1024)
+
+TokenType keyword_lookup(const char *text, size_t length);
+
+// The source must be followed by SOURCE_PADDING zero bytes, as source_load() does.
+// lex_next() pulls one token at a time from source.index, returning
+// TOKENTYPE_EOF once the source is exhausted; lex() collects them all.
+Token lex_next(Lexer *lexer);
 token_array lex(Lexer *lexer);
 
+// Same tokens (and atoms) as lex(), lexed in up to `threads` chunks at once;
+// 0 means one per online CPU
+token_array lex_parallel(Lexer *lexer, size_t threads);
+
+// Which tokens an incremental relex replaced
+typedef struct {
+    size_t first;       // index of the first changed token
+    size_t removed;     // old tokens dropped from there
+    size_t inserted;    // new tokens in their place
+} TokenEdit;
+
+// Replaces source bytes [start, end) with text and patches tokens (lexed
+// from lexer's source) to match, relexing only around the edit. The lexer's
+// source is edited in place by source_replace(). Relexing costs only what the
+// edit touches, but the bytes and tokens after it still move, and those
+// tokens' starts are shifted, so an edit is linear in what follows it.
+TokenEdit relex(Lexer *lexer, token_array *tokens, size_t start, size_t end, String text);
+
 #endif
\ No newline at end of file
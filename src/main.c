@@ -1,59 +1,103 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "lexer.h"
 #include "parser.h"
 #include "sema.h"
 #include "arena.h"
 #include "error.h"
+#include "cache.h"
 
-// this is completely unsafe lmao
-char *read_file(char *path) {
-    FILE *f = fopen(path, "r");
-    if (!f) {
-        perror("Failed to open file");
-        exit(1);
-    }
-    fseek(f, 0, SEEK_END);
-    size_t fsize = ftell(f);
-    fseek(f, 0, SEEK_SET);
-
-    char *data = malloc(fsize + 1);
-    if (!data) {
-        perror("Failed to allocate memory for file");
-        exit(1);
-    }
-    fread(data, fsize, 1, f);
-    fclose(f);
-    data[fsize] = 0;
-    return data;
+static void usage(char *argv0) {
+    fprintf(stderr, "usage: %s [--max-errors=N] [--mem-stats] <file.coda | ->\n", argv0);
+    exit(1);
 }
 
-Source setup_source(char *path) {
-    Source source;
-    source.path = string_make(path);
-    source.index = 0;
-    source.contents = string_make(read_file(path));
+int main(int argc, char **argv) {
+    char *path = NULL;
+    size_t max_errors = DIAGNOSTICS_DEFAULT_MAX;
 
-    return source;
-}
+    for (int i = 1; i < argc; i++) {
+        char *arg = argv[i];
+        if (strncmp(arg, "--max-errors=", 13) == 0) {
+            char *end;
+            max_errors = strtoul(arg + 13, &end, 10);
+            if (*end || end == arg + 13) usage(argv[0]);
+        } else if (strcmp(arg, "--mem-stats") == 0) {
+            // Printed however the compile ends, errors included
+            mem_stats_enable();
+            atexit(mem_stats_print);
+        } else if (arg[0] == '-' && arg[1] == '-') {
+            usage(argv[0]);
+        } else if (!path) {
+            path = arg;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (!path) usage(argv[0]);
 
-int main(void) {
     Lexer lexer = {
-        .arena = arena_create(),
-        .source = setup_source("test/main.coda")
+        .arena = arena_create_reserved(ARENA_RESERVE),
+        .source = source_load(path)
     };
     error_set_source(lexer.source);
 
-    token_array tokens = lex(&lexer);
+    // With CODA_CACHE_DIR set, a module that compiled cleanly before is
+    // mapped back from the cache instead of being lexed and parsed
+    char *cache_dir = getenv("CODA_CACHE_DIR");
+    char *cache_file = NULL;
+    uint64_t hash = 0;
+    CompactAst cached = {0};
+    Module *module = NULL;
+    if (cache_dir) {
+        hash = cache_hash(lexer.source.contents);
+        cache_file = cache_path(cache_dir, hash);
+        if (cache_load(cache_file, hash, lexer.source.contents.length, &cached)) {
+            mem_phase(MEM_PARSE);
+            module = ast_expand(&cached, lexer.arena);
+        }
+    }
 
-    Parser parser = {
-        .arena = lexer.arena,
-        .index = 0,
-        .tokens = tokens,
-    };
+    if (!module) {
+        // Tokens are lexed as the parser asks for them, so only the lookahead
+        // ring is ever alive. Big files are lexed up front on every core
+        // instead, which also lets their declarations be parsed in parallel.
+        // Syntax errors are printed as they are found; parsing carries on to
+        // report the rest, but the module does not go on to sema. Streamed
+        // tokens are counted as parsing in --mem-stats
+        Diagnostics diagnostics = diagnostics_init(max_errors, true);
+        Parser parser = {
+            .arena = lexer.arena,
+            .lexer = &lexer,
+            .diagnostics = &diagnostics,
+        };
+        if (lexer.source.contents.length >= 2 * LEX_PARALLEL_MIN_CHUNK) {
+            mem_phase(MEM_LEX);
+            parser.tokens = lex_parallel(&lexer, 0);
+            parser.lexer = NULL;
+        }
 
-    Module *module = parse_module(&parser);
+        mem_phase(MEM_PARSE);
+        module = parse_module_parallel(&parser, 0);
+        if (diagnostics.items.len) {
+            if (diagnostics.stopped) {
+                printf("too many errors, stopping after %zu\n", diagnostics.items.len);
+            }
+            return 1;
+        }
+    }
 
+    mem_phase(MEM_SEMA);
     Analyser analyser = analyser_init(module, lexer.arena);
     analyse(&analyser);
-}
\ No newline at end of file
+
+    if (cache_file && !cached.mapping) {
+        mem_phase(MEM_OTHER);
+        CompactAst ast = ast_compact(module);
+        if (!cache_store(cache_file, &ast, hash, lexer.source.contents.length)) {
+            fprintf(stderr, "warning: could not write %s\n", cache_file);
+        }
+        compact_free(&ast);
+    }
+}
@@ -1,28 +1,54 @@
 #include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "parser.h"
 #include "error.h"
 
-#define FALLTHROUGH
+#define FALLTHROUGH __attribute__((fallthrough));
 
-INSTANTIATE(Token, token, OPTIONAL_TEMPLATE)
+static Token pull(Parser *ctx) {
+    if (ctx->lexer) return lex_next(ctx->lexer);
+    return token_array_at(&ctx->tokens, ctx->fetched);
+}
+
+// Makes sure the token n places past the cursor is in the ring
+static Token *fill(Parser *ctx, size_t n) {
+    while (ctx->fetched <= ctx->index + n) {
+        ctx->ring[ctx->fetched % PARSER_LOOKAHEAD] = pull(ctx);
+        ctx->fetched++;
+    }
+    return &ctx->ring[(ctx->index + n) % PARSER_LOOKAHEAD];
+}
+
+// TOKENTYPE_EOF past the end
+static TokenType peek(Parser *ctx) {
+    return fill(ctx, 0)->type;
+}
+
+static TokenType ahead(Parser *ctx, size_t ahead) {
+    return fill(ctx, ahead)->type;
+}
 
-static token_optional peek(Parser *ctx) {
-    if (ctx->index >= ctx->tokens.len) return (token_optional){};
-    return (token_optional){true, ctx->tokens.data[ctx->index]};
+// Tokens are handed out in place, from the ring. A pointer stays valid until
+// the next consume(); copy the Token if it has to live longer. Past the end
+// the ring holds TOKENTYPE_EOF sentinels, so these never fail.
+static const Token *current(Parser *ctx) {
+    return fill(ctx, 0);
 }
 
-static token_optional ahead(Parser *ctx, size_t ahead) {
-    if (ctx->index + ahead >= ctx->tokens.len) return (token_optional){};
-    return (token_optional){true, ctx->tokens.data[ctx->index + ahead]};
+static const Token *consume(Parser *ctx) {
+    const Token *t = fill(ctx, 0);
+    ctx->index++;
+    return t;
 }
 
-static Token consume(Parser *ctx) {
-    return ctx->tokens.data[ctx->index++];
+const Token *parser_current(Parser *ctx) {
+    return current(ctx);
 }
 
-static Token expect(Parser *ctx, TokenType type, char *msg) {
-    token_optional t = peek(ctx);
-    if (!t.has_value || t.value.type != type) {
+static const Token *expect(Parser *ctx, TokenType type, char *msg) {
+    TokenType t = peek(ctx);
+    if (t != type) {
         error(ctx, msg);
     }
 
@@ -30,19 +56,20 @@ static Token expect(Parser *ctx, TokenType type, char *msg) {
 }
 
 Include *parse_include(Parser *ctx) {
-    Include *inc = arena_calloc(ctx->arena, sizeof(Include));
-    inc->token = consume(ctx);
+    Include *inc = arena_new(ctx->arena, Include);
+    inc->token = *consume(ctx);
+    inc->path = atom_array_init_in(ctx->arena);
 
     while (true) {
-        token_optional t = peek(ctx);
-        if (!t.has_value || t.value.type != TOKENTYPE_IDENT) {
+        TokenType t = peek(ctx);
+        if (t != TOKENTYPE_IDENT) {
             error(ctx, "Expected include path");
         }
 
-        string_array_push(&inc->path, consume(ctx).value.value);
+        atom_array_push(&inc->path, consume(ctx)->atom);
 
         t = peek(ctx);
-        if (t.has_value && t.value.type == TOKENTYPE_DOUBLECOLON) {
+        if (t == TOKENTYPE_DOUBLECOLON) {
             consume(ctx);
             continue;
         }
@@ -54,15 +81,16 @@ Include *parse_include(Parser *ctx) {
 }
 
 void collect_attributes(Parser *ctx, attr_array *out) {
-    token_optional t = peek(ctx);
-    while (t.has_value) {
-        if (t.value.type != TOKENTYPE_AT) break;
+    TokenType t = peek(ctx);
+    while (t != TOKENTYPE_EOF) {
+        if (t != TOKENTYPE_AT) break;
 
         consume(ctx);
-        Token name = consume(ctx);
-        Attribute attr;
-        attr.name = name.value.value;
-        attr.token = name;
+        const Token *name = consume(ctx);
+        Attribute attr = {
+            .name = name->atom,
+            .token = *name,
+        };
 
         // handle args here
 
@@ -72,54 +100,47 @@ void collect_attributes(Parser *ctx, attr_array *out) {
 }
 
 TypeRef *parse_type(Parser *ctx) {
-    token_optional first = peek(ctx);
+    TypeRef *base = arena_new(ctx->arena, TypeRef);
+    base->token = *current(ctx);
     bool is_mut = false;
 
-    token_optional t = peek(ctx);
-    if (t.has_value && t.value.type == TOKENTYPE_MUT) {
+    TokenType t = peek(ctx);
+    if (t == TOKENTYPE_MUT) {
         consume(ctx);
         is_mut = true;
     }
 
     t = peek(ctx);
-    if (!t.has_value || t.value.type != TOKENTYPE_IDENT) {
+    if (t != TOKENTYPE_IDENT) {
         error(ctx, "Expected type name");
     }
 
-    String type_name = consume(ctx).value.value;
-
-    TypeRef *base = arena_calloc(ctx->arena, sizeof(TypeRef));
     base->type = TYPEREF_NAMED;
-    base->named.name = type_name;
+    base->named.name = consume(ctx)->atom;
     base->is_mutable = is_mut;
-    if (t.has_value) {
-        base->token = first.value;
-    }
 
     while (true) {
-        token_optional t = peek(ctx);
-        if (t.has_value && t.value.type != TOKENTYPE_MUT && t.value.type != TOKENTYPE_STAR && t.value.type != TOKENTYPE_LBRACK) break;
+        TokenType t = peek(ctx);
+        if (t != TOKENTYPE_MUT && t != TOKENTYPE_STAR && t != TOKENTYPE_LBRACK) break;
 
         bool is_mut = false;
         t = peek(ctx);
-        if (t.has_value && t.value.type == TOKENTYPE_MUT) {
+        if (t == TOKENTYPE_MUT) {
             consume(ctx);
             is_mut = true;
         }
 
         t = peek(ctx);
-        if (t.has_value && t.value.type == TOKENTYPE_STAR) {
-            Token star_tok = consume(ctx);
-
-            TypeRef *ptr = arena_calloc(ctx->arena, sizeof(TypeRef));
+        if (t == TOKENTYPE_STAR) {
+            TypeRef *ptr = arena_new(ctx->arena, TypeRef);
+            ptr->token = *consume(ctx);
             ptr->type = TYPEREF_POINTER;
             ptr->pointer.pointee = base;
             ptr->is_mutable = is_mut;
-            ptr->token = star_tok;
 
             t = peek(ctx);
-            if (t.has_value && t.value.type == TOKENTYPE_QUESTION) {
-                Token q = consume(ctx);
+            if (t == TOKENTYPE_QUESTION) {
+                consume(ctx);
                 ptr->is_optional = true;
             }
 
@@ -128,29 +149,28 @@ TypeRef *parse_type(Parser *ctx) {
         }
 
         t = peek(ctx);
-        if (t.has_value && t.value.type == TOKENTYPE_LBRACK) {
-            Token lb = consume(ctx);
+        if (t == TOKENTYPE_LBRACK) {
+            TypeRef *array = arena_new(ctx->arena, TypeRef);
+            array->token = *consume(ctx);
+
             size_t length = 0;
             t = peek(ctx);
-            if (t.has_value && t.value.type == TOKENTYPE_INT_LIT) {
-                consume(ctx);
-                length = strtoul(t.value.value.value.data, NULL, 10);
+            if (t == TOKENTYPE_INT_LIT) {
+                length = consume(ctx)->number._int;
             }
             t = peek(ctx);
-            if (t.has_value && t.value.type != TOKENTYPE_RBRACK) {
+            if (t != TOKENTYPE_RBRACK) {
                 error(ctx, "Expected ']'");
             }
-            Token rb = consume(ctx);
+            consume(ctx);
 
-            TypeRef *array = arena_calloc(ctx->arena, sizeof(TypeRef));
             array->type = TYPEREF_ARRAY;
             array->array.elem = base;
             array->array.length = length;
             array->is_mutable = is_mut;
-            array->token = lb;
 
             t = peek(ctx);
-            if (t.has_value && t.value.type == TOKENTYPE_QUESTION) {
+            if (t == TOKENTYPE_QUESTION) {
                 consume(ctx);
                 array->is_optional = true;
             }
@@ -210,8 +230,8 @@ static int token_to_unary(TokenType type, UnaryOp *out) {
     }
 }
 
-Expr *expr_new_lit(Parser *ctx, Token *t) {
-    Expr *e = arena_calloc(ctx->arena, sizeof(Expr));
+Expr *expr_new_lit(Parser *ctx, const Token *t) {
+    Expr *e = arena_new(ctx->arena, Expr);
     e->type = EXPR_LIT;
     e->token = *t;
     
@@ -219,7 +239,14 @@ Expr *expr_new_lit(Parser *ctx, Token *t) {
         e->literal = (Literal){
             .type = LITERAL_INT,
             .raw = t->value.value,
-            ._int = strtoll(t->value.value.data, NULL, 0),
+            ._int = (int64_t)t->number._int,
+        };
+    }
+    else if (t->type == TOKENTYPE_FLOAT_LIT) {
+        e->literal = (Literal){
+            .type = LITERAL_FLOAT,
+            .raw = t->value.value,
+            ._float = t->number._float,
         };
     }
     else if (t->type == TOKENTYPE_STR_LIT) {
@@ -250,58 +277,56 @@ Expr *expr_new_lit(Parser *ctx, Token *t) {
     return e;
 }
 
-Expr *expr_new_ident(Parser *ctx, Token *t) {
-    string_array comps = string_array_init();
-    string_array_push(&comps, t->value.value);
+Expr *expr_new_ident(Parser *ctx, const Token *t) {
+    // t is gone once the path's components are consumed
+    Expr *e = arena_new(ctx->arena, Expr);
+    e->token = *t;
+
+    if (peek(ctx) != TOKENTYPE_DOUBLECOLON) {
+        e->type = EXPR_IDENT;
+        e->ident.name = e->token.atom;
+        return e;
+    }
+
+    atom_array comps = atom_array_init_in(ctx->arena);
+    atom_array_push(&comps, e->token.atom);
 
-    Token last = *t;
-    while (peek(ctx).has_value && peek(ctx).value.type == TOKENTYPE_DOUBLECOLON) {
+    while (peek(ctx) == TOKENTYPE_DOUBLECOLON) {
         consume(ctx);
-        Token comp = consume(ctx);
-        if (comp.type != TOKENTYPE_IDENT) {
+        const Token *comp = consume(ctx);
+        if (comp->type != TOKENTYPE_IDENT) {
             error(ctx, "Expected ident after '::'");
         }
 
-        string_array_push(&comps, comp.value.value);
-        last = comp;
+        atom_array_push(&comps, comp->atom);
     }
 
-    Expr *e = arena_calloc(ctx->arena, sizeof(Expr));
-    e->token = *t;
-
-    if (comps.len == 1) {
-        e->type = EXPR_IDENT;
-        e->ident.name = comps.data[0];
-    } else {
-        e->type = EXPR_PATH;
-        e->path.components = comps;
-    }
+    e->type = EXPR_PATH;
+    e->path.components = comps;
 
     return e;
 }
 
 Expr *parse_expr_prefix(Parser *ctx) {
-    token_optional t = peek(ctx);
+    TokenType t = peek(ctx);
 
-    if (!t.has_value) {
+    if (t == TOKENTYPE_EOF) {
         error(ctx, "Expected a token for expression");
     }
 
-    if (t.value.type == TOKENTYPE_INT_LIT || t.value.type == TOKENTYPE_STR_LIT || t.value.type == TOKENTYPE_CHAR_LIT || t.value.type == TOKENTYPE_TRUE || t.value.type == TOKENTYPE_FALSE) {
-        consume(ctx);
-        return expr_new_lit(ctx, &t.value);
+    if (t == TOKENTYPE_INT_LIT || t == TOKENTYPE_FLOAT_LIT || t == TOKENTYPE_STR_LIT || t == TOKENTYPE_CHAR_LIT || t == TOKENTYPE_TRUE || t == TOKENTYPE_FALSE) {
+        return expr_new_lit(ctx, consume(ctx));
     }
 
-    if (t.value.type == TOKENTYPE_IDENT) {
-        consume(ctx);
-        return expr_new_ident(ctx, &t.value);
+    if (t == TOKENTYPE_IDENT) {
+        return expr_new_ident(ctx, consume(ctx));
     }
 
-    if (t.value.type == TOKENTYPE_LPAREN) {
+    if (t == TOKENTYPE_LPAREN) {
         consume(ctx);
 
         t = peek(ctx);
-        if (t.has_value && (t.value.type == TOKENTYPE_IDENT || t.value.type == TOKENTYPE_MUT)) {
+        if (t == TOKENTYPE_IDENT || t == TOKENTYPE_MUT) {
             // TODO: type casting
         }
         Expr *inner = parse_expr(ctx, 0);
@@ -310,14 +335,12 @@ Expr *parse_expr_prefix(Parser *ctx) {
     }
 
     UnaryOp uop;
-    if (token_to_unary(t.value.type, &uop)) {
-        Token start = consume(ctx);
-        Expr *operand = parse_expr(ctx, 80);
-        Expr *e = arena_calloc(ctx->arena, sizeof(Expr));
+    if (token_to_unary(t, &uop)) {
+        Expr *e = arena_new(ctx->arena, Expr);
+        e->token = *consume(ctx);
         e->type = EXPR_UNARY;
         e->unary.op = uop;
-        e->unary.operand = operand;
-        e->token = start;
+        e->unary.operand = parse_expr(ctx, 80);
         return e;
     }
 
@@ -326,57 +349,52 @@ Expr *parse_expr_prefix(Parser *ctx) {
 
 Expr *expr_handle_postfix(Parser *ctx, Expr *left) {
     while (true) {
-        token_optional next = peek(ctx);
-        if (next.has_value && next.value.type == TOKENTYPE_LPAREN) {
+        TokenType next = peek(ctx);
+        if (next == TOKENTYPE_LPAREN) {
             consume(ctx);
-            exprs_array args = exprs_array_init();
+            exprs_array args = exprs_array_init_in(ctx->arena);
             next = peek(ctx);
-            if (!next.has_value || next.value.type != TOKENTYPE_RPAREN) {
+            if (next != TOKENTYPE_RPAREN) {
                 while (true) {
                     exprs_array_push(&args, parse_expr(ctx, 0));
 
                     next = peek(ctx);
-                    if (!next.has_value || next.value.type != TOKENTYPE_COMMA) break;
+                    if (next != TOKENTYPE_COMMA) break;
                     consume(ctx);
                 }
             }
 
-            Token start = consume(ctx);
-            Expr *call = arena_calloc(ctx->arena, sizeof(Expr));
+            Expr *call = arena_new(ctx->arena, Expr);
+            call->token = *consume(ctx);
             call->type = EXPR_CALL;
             call->call.callee = left;
             call->call.args = args;
-            call->token = start;
             left = call;
             continue;
-        } else if (next.has_value && next.value.type == TOKENTYPE_LBRACK) {
-            Token lb = consume(ctx);
-            Expr *len = parse_expr(ctx, 0);
-            Token rb = consume(ctx);
-            if (rb.type != TOKENTYPE_RBRACK) {
-                error(ctx, "Expected ']'");
-            }
-
-            Expr *index = arena_calloc(ctx->arena, sizeof(Expr));
-            index->token = lb;
+        } else if (next == TOKENTYPE_LBRACK) {
+            Expr *index = arena_new(ctx->arena, Expr);
+            index->token = *consume(ctx);
             index->type = EXPR_INDEX;
             index->index.base = left;
-            index->index.index = len;
+            index->index.index = parse_expr(ctx, 0);
+            if (consume(ctx)->type != TOKENTYPE_RBRACK) {
+                error(ctx, "Expected ']'");
+            }
 
             left = index;
             continue;
         }
-        else if (next.has_value && next.value.type == TOKENTYPE_DOT) {
+        else if (next == TOKENTYPE_DOT) {
             consume(ctx);
-            Token mem = consume(ctx);
-            if (mem.type != TOKENTYPE_IDENT) {
+            const Token *mem = consume(ctx);
+            if (mem->type != TOKENTYPE_IDENT) {
                 error(ctx, "Expected member name after '.'");
             }
-            Expr *m = arena_calloc(ctx->arena, sizeof(Expr));
-            m->token = mem;
+            Expr *m = arena_new(ctx->arena, Expr);
+            m->token = *mem;
             m->type = EXPR_MEMBER;
             m->member.base = left;
-            m->member.member = mem.value.value;
+            m->member.member = mem->atom;
             left = m;
             continue;
         } else {
@@ -392,22 +410,22 @@ Expr *parse_expr(Parser *ctx, int min_bp) {
     left = expr_handle_postfix(ctx, left);
 
     while (true) {
-        token_optional next = peek(ctx);
-        if (!next.has_value || next.value.type == TOKENTYPE_SEMICOLON || next.value.type == TOKENTYPE_COMMA || next.value.type == TOKENTYPE_RPAREN || next.value.type == TOKENTYPE_RBRACK) {
+        TokenType next = peek(ctx);
+        if (next == TOKENTYPE_EOF || next == TOKENTYPE_SEMICOLON || next == TOKENTYPE_COMMA || next == TOKENTYPE_RPAREN || next == TOKENTYPE_RBRACK) {
             break;
         }
 
         BinaryOp binop;
         int right_assoc = 1;
-        int bp = bp_for_binary(next.value.type, &right_assoc, &binop);
+        int bp = bp_for_binary(next, &right_assoc, &binop);
         if (bp == 0 || bp <= min_bp) break;
 
-        Token op_tok = consume(ctx);
+        consume(ctx);
 
         int rbp = right_assoc ? bp - 1 : bp;
 
         Expr *right = parse_expr(ctx, rbp);
-        Expr *b = arena_calloc(ctx->arena, sizeof(Expr));
+        Expr *b = arena_new(ctx->arena, Expr);
         b->type = EXPR_BINARY;
         b->binary.op = binop;
         b->binary.left = left;
@@ -422,17 +440,16 @@ Expr *parse_expr(Parser *ctx, int min_bp) {
 }
 
 Stmt *parse_return_stmt(Parser *ctx) {
-    Token start = consume(ctx);
+    Stmt *s = arena_new(ctx->arena, Stmt);
+    s->token = *consume(ctx);
     Expr *value = NULL;
-    token_optional t = peek(ctx);
-    if (!t.has_value || t.value.type != TOKENTYPE_SEMICOLON) {
+    TokenType t = peek(ctx);
+    if (t != TOKENTYPE_SEMICOLON) {
         value = parse_expr(ctx, 0);
     }
 
     expect(ctx, TOKENTYPE_SEMICOLON, "Expected semicolon");
 
-    Stmt *s = arena_calloc(ctx->arena, sizeof(Stmt));
-    s->token = start;
     s->type = STMT_RETURN;
     s->_return.value = value;
 
@@ -440,14 +457,15 @@ Stmt *parse_return_stmt(Parser *ctx) {
 }
 
 Stmt *parse_for_stmt(Parser *ctx) {
-    Token start = consume(ctx);
+    Stmt *s = arena_new(ctx->arena, Stmt);
+    s->token = *consume(ctx);
 
     expect(ctx, TOKENTYPE_LPAREN, "Expected '('");
 
     Stmt *init = NULL;
-    token_optional t = peek(ctx);
-    if (!t.has_value || t.value.type != TOKENTYPE_SEMICOLON) {
-        if (t.value.type == TOKENTYPE_IDENT || t.value.type == TOKENTYPE_MUT) {
+    TokenType t = peek(ctx);
+    if (t != TOKENTYPE_SEMICOLON) {
+        if (t == TOKENTYPE_IDENT || t == TOKENTYPE_MUT) {
             init = parse_var_stmt(ctx);
         } else {
             init = parse_expr_stmt(ctx);
@@ -459,26 +477,24 @@ Stmt *parse_for_stmt(Parser *ctx) {
 
     Expr *cond = NULL;
     t = peek(ctx);
-    if (!t.has_value || t.value.type != TOKENTYPE_SEMICOLON) {
+    if (t != TOKENTYPE_SEMICOLON) {
         cond = parse_expr(ctx, 0);
     }
     expect(ctx, TOKENTYPE_SEMICOLON, "Expected ';'");
 
     Expr *post = NULL;
     t = peek(ctx);
-    if (!t.has_value || t.value.type != TOKENTYPE_RPAREN) {
+    if (t != TOKENTYPE_RPAREN) {
         post = parse_expr(ctx, 0);
     }
     expect(ctx, TOKENTYPE_RPAREN, "Expected ')'");
 
     t = peek(ctx);
-    if (!t.has_value || t.value.type != TOKENTYPE_LBRACE) {
+    if (t != TOKENTYPE_LBRACE) {
         error(ctx, "Expected '{'");
     }
     Stmt *body = parse_block_stmt(ctx);
 
-    Stmt *s = arena_calloc(ctx->arena, sizeof(Stmt));
-    s->token = start;
     s->type = STMT_FOR;
     s->_for.init = init;
     s->_for.cond = cond;
@@ -489,32 +505,31 @@ Stmt *parse_for_stmt(Parser *ctx) {
 }
 
 Stmt *parse_if_stmt(Parser *ctx) {
-    Token start = consume(ctx);
-    token_optional t = peek(ctx);
-    if (!t.has_value || t.value.type != TOKENTYPE_LPAREN) {
+    Stmt *s = arena_new(ctx->arena, Stmt);
+    s->token = *consume(ctx);
+    TokenType t = peek(ctx);
+    if (t != TOKENTYPE_LPAREN) {
         error(ctx, "Expected '('");
     }
     Expr *cond = parse_expr(ctx, 0);
 
     t = peek(ctx);
-    if (!t.has_value || t.value.type != TOKENTYPE_LBRACE) {
+    if (t != TOKENTYPE_LBRACE) {
         error(ctx, "Expected '{'");
     }
 
     Stmt *then = parse_block_stmt(ctx);
     Stmt *_else = NULL;
     t = peek(ctx);
-    if (t.has_value && t.value.type == TOKENTYPE_ELSE) {
+    if (t == TOKENTYPE_ELSE) {
         consume(ctx);
         t = peek(ctx);
-        if (!t.has_value || t.value.type != TOKENTYPE_LBRACE) {
+        if (t != TOKENTYPE_LBRACE) {
             error(ctx, "Expected '{'");
         }
         _else = parse_block_stmt(ctx);
     }
 
-    Stmt *s = arena_calloc(ctx->arena, sizeof(Stmt));
-    s->token = start;
     s->type = STMT_IF;
     s->_if.cond = cond;
     s->_if.then = then;
@@ -524,22 +539,21 @@ Stmt *parse_if_stmt(Parser *ctx) {
 }
 
 Stmt *parse_while_stmt(Parser *ctx) {
-    Token start = consume(ctx);
+    Stmt *s = arena_new(ctx->arena, Stmt);
+    s->token = *consume(ctx);
 
-    token_optional t = peek(ctx);
-    if (!t.has_value || t.value.type != TOKENTYPE_LPAREN) {
+    TokenType t = peek(ctx);
+    if (t != TOKENTYPE_LPAREN) {
         error(ctx, "Expected '('");
     }
     Expr *cond = parse_expr(ctx, 0);
 
     t = peek(ctx);
-    if (!t.has_value || t.value.type != TOKENTYPE_LBRACE) {
+    if (t != TOKENTYPE_LBRACE) {
         error(ctx, "Expected '{'");
     }
     Stmt *body = parse_block_stmt(ctx);
 
-    Stmt *s = arena_calloc(ctx->arena, sizeof(Stmt));
-    s->token = start;
     s->type = STMT_WHILE;
     s->_while.cond = cond;
     s->_while.body = body;
@@ -550,27 +564,27 @@ Stmt *parse_while_stmt(Parser *ctx) {
 Stmt *parse_var_stmt(Parser *ctx) {
     TypeRef *type = NULL;
 
-    token_optional t = ahead(ctx, 1);
-    if (!t.has_value || t.value.type != TOKENTYPE_EQ) {
+    TokenType t = ahead(ctx, 1);
+    if (t != TOKENTYPE_EQ) {
         type = parse_type(ctx);
     }
 
-    Token name = expect(ctx, TOKENTYPE_IDENT, "Expected variable name");
+    const Token *name = expect(ctx, TOKENTYPE_IDENT, "Expected variable name");
 
-    VarDecl *v = arena_calloc(ctx->arena, sizeof(VarDecl));
-    v->token = name;
+    VarDecl *v = arena_new(ctx->arena, VarDecl);
+    v->token = *name;
     v->type = type;
-    v->name = name.value.value;
+    v->name = name->atom;
 
     t = peek(ctx);
-    if (t.has_value && t.value.type == TOKENTYPE_EQ) {
+    if (t == TOKENTYPE_EQ) {
         consume(ctx);
         v->init = parse_expr(ctx, 0);
     }
     expect(ctx, TOKENTYPE_SEMICOLON, "Expected ';'");
 
-    Stmt *s = arena_calloc(ctx->arena, sizeof(Stmt));
-    s->token = name;
+    Stmt *s = arena_new(ctx->arena, Stmt);
+    s->token = v->token;
     s->type = STMT_VAR;
     s->var = v;
 
@@ -581,7 +595,7 @@ Stmt *parse_expr_stmt(Parser *ctx) {
     Expr *e = parse_expr(ctx, 0);
     expect(ctx, TOKENTYPE_SEMICOLON, "Expected ';'");
 
-    Stmt *s = arena_calloc(ctx->arena, sizeof(Stmt));
+    Stmt *s = arena_new(ctx->arena, Stmt);
     s->token = e->token;
     s->type = STMT_EXPR;
     s->expr = e;
@@ -590,25 +604,24 @@ Stmt *parse_expr_stmt(Parser *ctx) {
 }
 
 Stmt *parse_stmt(Parser *ctx) {
-    attr_array attrs = attr_array_init();
+    attr_array attrs = attr_array_init_in(ctx->arena);
     collect_attributes(ctx, &attrs);
 
-    token_optional t = peek(ctx);
+    TokenType t = peek(ctx);
 
-    if (!t.has_value) return NULL;  // error?
+    if (t == TOKENTYPE_EOF) return NULL;  // error?
 
-    switch (t.value.type) {
+    switch (t) {
         case TOKENTYPE_RETURN: return parse_return_stmt(ctx);
         case TOKENTYPE_FOR: return parse_for_stmt(ctx);
         case TOKENTYPE_IF: return parse_if_stmt(ctx);
         case TOKENTYPE_WHILE: return parse_while_stmt(ctx);
         case TOKENTYPE_IDENT: {
             t = ahead(ctx, 1);
-            if (t.has_value && (t.value.type == TOKENTYPE_DOUBLECOLON || t.value.type == TOKENTYPE_EQ)) {
+            if (t == TOKENTYPE_DOUBLECOLON || t == TOKENTYPE_EQ) {
                 return parse_expr_stmt(ctx);
-            } else {
-                FALLTHROUGH
             }
+            FALLTHROUGH
         }
         case TOKENTYPE_MUT: return parse_var_stmt(ctx);
         default: break;
@@ -617,20 +630,72 @@ Stmt *parse_stmt(Parser *ctx) {
     return parse_expr_stmt(ctx);
 }
 
+static bool is_decl_keyword(TokenType t) {
+    return t == TOKENTYPE_FN || t == TOKENTYPE_STRUCT || t == TOKENTYPE_UNION || t == TOKENTYPE_INCLUDE;
+}
+
+// Offset of the error just recorded, for the node standing in for it
+static Token error_token(Parser *ctx) {
+    diagnostic_array *items = &ctx->diagnostics->items;
+    return (Token){ .span = { .start = items->data[items->len - 1].offset } };
+}
+
+// Panic mode: skips the rest of a broken statement, up to and including its
+// ';' or closing '}', but not the '}' of the enclosing block. Returns false
+// at a declaration keyword, meaning the block itself never closed.
+static bool sync_stmt(Parser *ctx) {
+    size_t depth = 0;
+    while (true) {
+        TokenType t = peek(ctx);
+        if (t == TOKENTYPE_EOF) return true;
+        if (is_decl_keyword(t)) return false;
+        if (t == TOKENTYPE_RBRACE && depth == 0) return true;
+
+        consume(ctx);
+        if (t == TOKENTYPE_LBRACE) depth++;
+        else if (t == TOKENTYPE_RBRACE && --depth == 0) return true;
+        else if (t == TOKENTYPE_SEMICOLON && depth == 0) return true;
+    }
+}
+
+// parse_stmt() under a recovery point: a syntax error is recorded, the rest
+// of the statement skipped and a STMT_ERROR left in its place
+static Stmt *parse_stmt_recovering(Parser *ctx) {
+    if (!ctx->diagnostics) return parse_stmt(ctx);
+
+    jmp_buf here;
+    jmp_buf *outer = ctx->recover;
+    if (setjmp(here) == 0) {
+        ctx->recover = &here;
+        Stmt *s = parse_stmt(ctx);
+        ctx->recover = outer;
+        return s;
+    }
+
+    ctx->recover = outer;
+    if (ctx->diagnostics->stopped || !sync_stmt(ctx)) {
+        error_resume(ctx);
+    }
+
+    Stmt *s = arena_new(ctx->arena, Stmt);
+    s->type = STMT_ERROR;
+    s->token = error_token(ctx);
+    return s;
+}
+
 Stmt *parse_block_stmt(Parser *ctx) {
-    Token start = consume(ctx);
+    Stmt *s = arena_new(ctx->arena, Stmt);
+    s->token = *consume(ctx);
 
-    stmts_array stmts = stmts_array_init();
-    token_optional t = peek(ctx);
-    while (t.has_value && t.value.type != TOKENTYPE_RBRACE) {
-        stmts_array_push(&stmts, parse_stmt(ctx));
+    stmts_array stmts = stmts_array_init_in(ctx->arena);
+    TokenType t = peek(ctx);
+    while (t != TOKENTYPE_EOF && t != TOKENTYPE_RBRACE) {
+        stmts_array_push(&stmts, parse_stmt_recovering(ctx));
         t = peek(ctx);
     }
 
     expect(ctx, TOKENTYPE_RBRACE, "Expected '}'");
 
-    Stmt *s = arena_calloc(ctx->arena, sizeof(Stmt));
-    s->token = start;
     s->type = STMT_BLOCK;
     s->block.stmts = stmts;
 
@@ -638,25 +703,22 @@ Stmt *parse_block_stmt(Parser *ctx) {
 }
 
 StructDecl *parse_struct_decl(Parser *ctx, attr_array attrs) {
-    StructDecl *str = arena_calloc(ctx->arena, sizeof(StructDecl));
+    StructDecl *str = arena_new(ctx->arena, StructDecl);
+    str->token = *consume(ctx);
     str->attributes = attrs;
-    consume(ctx);
+    str->members = vardecls_array_init_in(ctx->arena);
 
-    Token name = expect(ctx, TOKENTYPE_IDENT, "Expected struct name");
-    str->name = name.value.value;
+    str->name = expect(ctx, TOKENTYPE_IDENT, "Expected struct name")->atom;
 
     expect(ctx, TOKENTYPE_LBRACE, "Expected '{'");
 
-    token_optional t = peek(ctx);
-    while (t.has_value && t.value.type != TOKENTYPE_RBRACE) {
-        TypeRef *type = parse_type(ctx);
-        Token name = expect(ctx, TOKENTYPE_IDENT, "Expected member name");
+    TokenType t = peek(ctx);
+    while (t != TOKENTYPE_EOF && t != TOKENTYPE_RBRACE) {
+        VarDecl *decl = arena_new(ctx->arena, VarDecl);
+        decl->type = parse_type(ctx);
+        decl->token = *expect(ctx, TOKENTYPE_IDENT, "Expected member name");
+        decl->name = decl->token.atom;
         expect(ctx, TOKENTYPE_SEMICOLON, "Expected ';'");
-
-        VarDecl *decl = arena_calloc(ctx->arena, sizeof(VarDecl));
-        decl->token = name;
-        decl->type = type;
-        decl->name = name.value.value;
         vardecls_array_push(&str->members, decl);
 
         t = peek(ctx);
@@ -668,27 +730,22 @@ StructDecl *parse_struct_decl(Parser *ctx, attr_array attrs) {
 }
 
 UnionDecl *parse_union_decl(Parser *ctx, attr_array attrs) {
-    Token start = consume(ctx);
-    UnionDecl *un = arena_calloc(ctx->arena, sizeof(UnionDecl));
-    un->token = start;
+    UnionDecl *un = arena_new(ctx->arena, UnionDecl);
+    un->token = *consume(ctx);
     un->attributes = attrs;
-    un->members = vardecls_array_init();
+    un->members = vardecls_array_init_in(ctx->arena);
 
-    Token name = expect(ctx, TOKENTYPE_IDENT, "Expected union name");
-    un->name = name.value.value;
+    un->name = expect(ctx, TOKENTYPE_IDENT, "Expected union name")->atom;
 
     expect(ctx, TOKENTYPE_LBRACE, "Expected '{'");
 
-    token_optional t = peek(ctx);
-    while (t.has_value && t.value.type != TOKENTYPE_RBRACE) {
-        TypeRef *type = parse_type(ctx);
-        Token name = expect(ctx, TOKENTYPE_IDENT, "Expected member name");
+    TokenType t = peek(ctx);
+    while (t != TOKENTYPE_EOF && t != TOKENTYPE_RBRACE) {
+        VarDecl *decl = arena_new(ctx->arena, VarDecl);
+        decl->type = parse_type(ctx);
+        decl->token = *expect(ctx, TOKENTYPE_IDENT, "Expected member name");
+        decl->name = decl->token.atom;
         expect(ctx, TOKENTYPE_SEMICOLON, "Expected ';'");
-
-        VarDecl *decl = arena_calloc(ctx->arena, sizeof(VarDecl));
-        decl->token = name;
-        decl->type = type;
-        decl->name = name.value.value;
         vardecls_array_push(&un->members, decl);
 
         t = peek(ctx);
@@ -699,61 +756,97 @@ UnionDecl *parse_union_decl(Parser *ctx, attr_array attrs) {
     return un;
 }
 
+// Steps over the body at the cursor by brace matching and records where it
+// was. Returns false (leaving the cursor alone) when bodies are parsed
+// eagerly, or when the braces do not close so parsing reports the error.
+static bool skip_fn_body(Parser *ctx, FnDecl *fn) {
+    if (!ctx->lazy_bodies || ctx->lexer) return false;
+
+    uint8_t *kinds = ctx->tokens.kinds;
+    size_t depth = 0;
+    for (size_t i = ctx->index; i < ctx->tokens.len; i++) {
+        if (kinds[i] == TOKENTYPE_LBRACE) depth++;
+        else if (kinds[i] == TOKENTYPE_RBRACE && --depth == 0) {
+            fn->lazy_body = (LazyBody){
+                .tokens = ctx->lazy_bodies,
+                .start = ctx->index,
+                .arena = ctx->arena,
+            };
+            // Whatever the ring held is dropped; refilling starts past the body
+            ctx->index = ctx->fetched = i + 1;
+            return true;
+        }
+    }
+
+    return false;
+}
+
 FnDecl *parse_fn_decl(Parser *ctx, attr_array attrs) {
-    Token start = consume(ctx);
-    FnDecl *fn = arena_calloc(ctx->arena, sizeof(FnDecl));
-    fn->token = start;
+    FnDecl *fn = arena_new(ctx->arena, FnDecl);
+    fn->token = *consume(ctx);
     fn->attributes = attrs;
-    fn->params = param_array_init();
+    fn->params = param_array_init_in(ctx->arena);
 
-    TypeRef *ret_type = parse_type(ctx);
-    Token fn_name = expect(ctx, TOKENTYPE_IDENT, "Expected fn name");
+    fn->ret_type = parse_type(ctx);
+    fn->name = expect(ctx, TOKENTYPE_IDENT, "Expected fn name")->atom;
     expect(ctx, TOKENTYPE_LPAREN, "Expected '('");
 
-    token_optional t = peek(ctx);
-    while (t.has_value && t.value.type != TOKENTYPE_RPAREN) {
-        attr_array attrs = attr_array_init();
+    TokenType t = peek(ctx);
+    while (t != TOKENTYPE_EOF && t != TOKENTYPE_RPAREN) {
+        attr_array attrs = attr_array_init_in(ctx->arena);
         collect_attributes(ctx, &attrs);
 
         TypeRef *param_type = parse_type(ctx);
-        Token name = expect(ctx, TOKENTYPE_IDENT, "Expected param name");
-
         Param p = (Param){
             .type = param_type,
-            .name = name.value.value,
+            .name = expect(ctx, TOKENTYPE_IDENT, "Expected param name")->atom,
             .attributes = attrs,
         };
 
         param_array_push(&fn->params, p);
         t = peek(ctx);
-        if (!t.has_value || t.value.type != TOKENTYPE_COMMA) break;
+        if (t != TOKENTYPE_COMMA) break;
         consume(ctx);
         t = peek(ctx);
     }
     consume(ctx);
 
     t = peek(ctx);
-    if (t.has_value && t.value.type == TOKENTYPE_LBRACE) {
-        fn->body = parse_block_stmt(ctx);
+    if (t == TOKENTYPE_LBRACE) {
+        if (!skip_fn_body(ctx, fn)) {
+            fn->body = parse_block_stmt(ctx);
+        }
     }
 
-    fn->name = fn_name.value.value;
-    fn->ret_type = ret_type;
-
     return fn;
 }
 
+Stmt *parse_fn_body(FnDecl *fn) {
+    LazyBody *lazy = &fn->lazy_body;
+    if (!fn->body && lazy->tokens) {
+        Parser parser = {
+            .tokens = *lazy->tokens,
+            .index = lazy->start,
+            .fetched = lazy->start,
+            .arena = lazy->arena,
+        };
+        fn->body = parse_block_stmt(&parser);
+        lazy->tokens = NULL;
+    }
+    return fn->body;
+}
+
 Decl *parse_decl(Parser *ctx) {
-    Decl *d = arena_calloc(ctx->arena, sizeof(Decl));
-    attr_array attrs = attr_array_init();
+    Decl *d = arena_new(ctx->arena, Decl);
+    attr_array attrs = attr_array_init_in(ctx->arena);
     collect_attributes(ctx, &attrs);
 
-    token_optional t = peek(ctx);
-    if (!t.has_value) {
+    TokenType t = peek(ctx);
+    if (t == TOKENTYPE_EOF) {
         error(ctx, "Unexpected end of file");
     }
 
-    switch (t.value.type) {
+    switch (t) {
         case TOKENTYPE_FN: {
             d->type = DECL_FN;
             d->fn = parse_fn_decl(ctx, attrs);
@@ -780,30 +873,212 @@ Decl *parse_decl(Parser *ctx) {
     return d;
 }
 
-Module *parse_module(Parser *ctx) {
-    Token start = expect(ctx, TOKENTYPE_MODULE, "Expected module");
-
-    Module *m = arena_calloc(ctx->arena, sizeof(Module));
-    m->token = start;
-    m->includes = includes_array_init();
-    m->decls = decls_array_init();
+// `module` and the `include` lines; the declarations are left to the caller
+static Module *parse_module_header(Parser *ctx) {
+    Module *m = arena_new(ctx->arena, Module);
+    m->token = *expect(ctx, TOKENTYPE_MODULE, "Expected module");
+    m->includes = includes_array_init_in(ctx->arena);
+    m->decls = decls_array_init_in(ctx->arena);
 
-    Token modname = expect(ctx, TOKENTYPE_IDENT, "Expected module name");
-    m->name = modname.value.value;
+    m->name = expect(ctx, TOKENTYPE_IDENT, "Expected module name")->atom;
 
     expect(ctx, TOKENTYPE_SEMICOLON, "Expected ';'");
 
-    token_optional t = peek(ctx);
-    while (t.has_value) {
-        if (t.value.type != TOKENTYPE_INCLUDE) break;
+    TokenType t = peek(ctx);
+    while (t != TOKENTYPE_EOF) {
+        if (t != TOKENTYPE_INCLUDE) break;
         includes_array_push(&m->includes, parse_include(ctx));
         t = peek(ctx);
     }
 
-    while (t.has_value) {
-        decls_array_push(&m->decls, parse_decl(ctx));
+    return m;
+}
+
+// parse_decl() under a recovery point: after a syntax error everything up to
+// the next declaration keyword is skipped and a DECL_ERROR left in place.
+// Returns NULL once the diagnostics buffer is full.
+static Decl *parse_decl_recovering(Parser *ctx) {
+    if (!ctx->diagnostics) return parse_decl(ctx);
+
+    size_t start = ctx->index;
+    jmp_buf here;
+    jmp_buf *outer = ctx->recover;
+    if (setjmp(here) == 0) {
+        ctx->recover = &here;
+        Decl *d = parse_decl(ctx);
+        ctx->recover = outer;
+        return d;
+    }
+
+    ctx->recover = outer;
+    if (ctx->diagnostics->stopped) return NULL;
+
+    // A declaration that failed on its first token would fail there again
+    if (ctx->index == start && peek(ctx) != TOKENTYPE_EOF) consume(ctx);
+
+    TokenType t = peek(ctx);
+    while (t != TOKENTYPE_EOF && !is_decl_keyword(t)) {
+        consume(ctx);
+        t = peek(ctx);
+    }
+
+    Decl *d = arena_new(ctx->arena, Decl);
+    d->type = DECL_ERROR;
+    d->token = error_token(ctx);
+    return d;
+}
+
+static void parse_decls(Parser *ctx, Module *m) {
+    TokenType t = peek(ctx);
+    while (t != TOKENTYPE_EOF) {
+        Decl *d = parse_decl_recovering(ctx);
+        if (!d) break;
+        decls_array_push(&m->decls, d);
         t = peek(ctx);
     }
+}
+
+Module *parse_module(Parser *ctx) {
+    Module *m = parse_module_header(ctx);
+    parse_decls(ctx, m);
+    return m;
+}
+
+// Splits tokens [from, len) into at most `chunks` runs of whole top-level
+// declarations. A declaration ends where a closing brace brings the depth
+// back to zero; runs are cut at the first such point past each even share
+// of the tokens. Fills starts[] and returns the number of runs, or 0 if the
+// braces do not balance (the sequential parser then reports the error).
+static size_t find_decl_runs(token_array *tokens, size_t from, size_t *starts, size_t chunks) {
+    size_t count = 0;
+    starts[count++] = from;
+
+    size_t n = tokens->len - from;
+    size_t target = from + n / chunks;
+    long depth = 0;
+
+    for (size_t i = from; i < tokens->len; i++) {
+        switch (tokens->kinds[i]) {
+            case TOKENTYPE_LBRACE: depth++; break;
+            case TOKENTYPE_RBRACE: {
+                depth--;
+                if (depth < 0) return 0;
+                if (depth == 0 && i + 1 >= target && i + 1 < tokens->len && count < chunks) {
+                    starts[count++] = i + 1;
+                    target = from + count * n / chunks;
+                }
+                break;
+            }
+            default: break;
+        }
+    }
+
+    return depth == 0 ? count : 0;
+}
+
+typedef struct {
+    Parser parser;
+    Diagnostics diagnostics;
+    size_t end;
+    decls_array decls;
+    pthread_t thread;
+} DeclRun;
+
+static void *parse_decl_run(void *arg) {
+    DeclRun *run = arg;
+    while (run->parser.index < run->end) {
+        Decl *d = parse_decl_recovering(&run->parser);
+        if (!d) break;
+        decls_array_push(&run->decls, d);
+    }
+    return NULL;
+}
+
+Module *parse_module_parallel(Parser *ctx, size_t threads) {
+    if (ctx->lexer) return parse_module(ctx);
+
+    Module *m = parse_module_header(ctx);
+    size_t from = ctx->index;
+
+    if (threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? cpus : 1;
+    }
+    size_t max_runs = from < ctx->tokens.len ? (ctx->tokens.len - from) / PARSE_PARALLEL_MIN_TOKENS : 0;
+    if (threads > max_runs) threads = max_runs;
+
+    size_t *starts = malloc((threads ? threads : 1) * sizeof(size_t));
+    if (!starts) {
+        fprintf(stderr, "parse_module_parallel: malloc failed\n");
+        exit(1);
+    }
+
+    size_t count = threads >= 2 ? find_decl_runs(&ctx->tokens, from, starts, threads) : 0;
+    if (count < 2) {
+        free(starts);
+        parse_decls(ctx, m);
+        return m;
+    }
+
+    DeclRun *runs = calloc(count, sizeof(DeclRun));
+    if (!runs) {
+        fprintf(stderr, "parse_module_parallel: calloc failed\n");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        DeclRun *run = &runs[i];
+        run->end = (i + 1 < count) ? starts[i + 1] : ctx->tokens.len;
+        run->decls = decls_array_init();
+
+        // Each run allocates from its own arena, adopted by ctx's once joined.
+        // Runs parse bodies eagerly, since a skipped one would remember the
+        // run's arena, which is gone by then.
+        run->parser = (Parser){
+            .tokens = ctx->tokens,
+            .index = starts[i],
+            .fetched = starts[i],
+            .arena = arena_create(),
+        };
+
+        // A run only notes where its first error is, and never exits: the
+        // module is then reparsed sequentially, so errors are rendered once,
+        // in order and from this thread
+        run->diagnostics = diagnostics_init(1, false);
+        run->diagnostics.offsets_only = true;
+        run->parser.diagnostics = &run->diagnostics;
+
+        if (pthread_create(&run->thread, NULL, parse_decl_run, run) != 0) {
+            fprintf(stderr, "parse_module_parallel: pthread_create failed\n");
+            exit(1);
+        }
+    }
+
+    // A run whose last declaration reads past its end was cut in the wrong
+    // place by malformed input; reparse sequentially so errors come out right
+    bool clean = true;
+    for (size_t i = 0; i < count; i++) {
+        pthread_join(runs[i].thread, NULL);
+        arena_adopt(ctx->arena, runs[i].parser.arena);
+        if (runs[i].parser.index != runs[i].end) clean = false;
+        if (runs[i].diagnostics.items.len) clean = false;
+        diagnostics_free(&runs[i].diagnostics);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        for (size_t j = 0; clean && j < runs[i].decls.len; j++) {
+            decls_array_push(&m->decls, runs[i].decls.data[j]);
+        }
+        decls_array_free(&runs[i].decls);
+    }
+    free(runs);
+    free(starts);
+
+    if (!clean) {
+        parse_decls(ctx, m);
+        return m;
+    }
 
+    ctx->index = ctx->fetched = ctx->tokens.len;
     return m;
 }
\ No newline at end of file
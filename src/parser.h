@@ -1,16 +1,42 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <setjmp.h>
 #include "ast.h"
 #include "lexer.h"
 
+typedef struct Diagnostics Diagnostics;
+
+// Tokens the parser can see ahead of the cursor; a power of two, larger
+// than the deepest ahead() the grammar uses
+#define PARSER_LOOKAHEAD 4
+
 typedef struct {
+    // Exactly one token source is used: when lexer is set tokens are lexed
+    // on demand (streaming), otherwise they are read from a pre-lexed array
+    Lexer *lexer;
     token_array tokens;
-    size_t index;
+
+    size_t index;       // tokens consumed
+    size_t fetched;     // tokens pulled into the ring, index <= fetched
+    Token ring[PARSER_LOOKAHEAD];
+
+    // When set (to the array tokens was copied from, which must outlive the
+    // AST), function bodies are only brace-matched and parsed on demand.
+    // main leaves it unset: sema and the cache writer read every body, so
+    // skipping them would only defer the work and its syntax errors.
+    token_array *lazy_bodies;
+
+    // When set, syntax errors are collected here and parsing resynchronises
+    // after each one (see error_parser()); otherwise the first is fatal
+    Diagnostics *diagnostics;
+    jmp_buf *recover;   // innermost recovery point
     
     Arena *arena;
 } Parser;
 
+const Token *parser_current(Parser *ctx);
+
 Include *parse_include(Parser *ctx);
 TypeRef *parse_type(Parser *ctx);
 Expr *parse_expr_prefix(Parser *ctx);
@@ -27,7 +53,16 @@ Stmt *parse_block_stmt(Parser *ctx);
 StructDecl *parse_struct_decl(Parser *ctx, attr_array attrs);
 UnionDecl *parse_union_decl(Parser *ctx, attr_array attrs);
 FnDecl *parse_fn_decl(Parser *ctx, attr_array attrs);
+Stmt *parse_fn_body(FnDecl *fn);
 Decl *parse_decl(Parser *ctx);
 Module *parse_module(Parser *ctx);
 
+// Below this many tokens per worker parse_module_parallel() stays sequential
+#define PARSE_PARALLEL_MIN_TOKENS (16 * 1024)
+
+// Like parse_module(), but the top-level declarations of a pre-lexed token
+// array are parsed by up to `threads` workers (0: one per online CPU) and
+// merged in source order. Streaming parsers fall back to parse_module().
+Module *parse_module_parallel(Parser *ctx, size_t threads);
+
 #endif
\ No newline at end of file
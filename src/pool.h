@@ -0,0 +1,49 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <string.h>
+#include "instantiate.h"
+#include "arena.h"
+
+// Objects of one type carved out of an arena, POOL_SLAB at a time. They
+// are not freed one by one: N_pool_release() takes every object back at once
+// and reuses the slabs.
+#define POOL_SLAB 64
+
+#define POOL_TEMPLATE(T, N) \
+typedef struct N##_pool_slab { \
+    struct N##_pool_slab *next; \
+    T items[POOL_SLAB]; \
+} N##_pool_slab; \
+typedef struct { \
+    Arena *arena; \
+    N##_pool_slab *first; \
+    N##_pool_slab *slab;    /* the one being carved up, NULL before the first */ \
+    size_t used;            /* items taken from slab */ \
+} N##_pool; \
+static inline N##_pool N##_pool_init(Arena *a) { \
+    return (N##_pool){ .arena = a, .used = POOL_SLAB }; \
+} \
+/* A zeroed T */ \
+static inline T *N##_pool_new(N##_pool *p) { \
+    if (p->used == POOL_SLAB) { \
+        N##_pool_slab *next = p->slab ? p->slab->next : p->first; \
+        if (!next) { \
+            next = arena_new(p->arena, N##_pool_slab); \
+            if (p->slab) p->slab->next = next; \
+            else p->first = next; \
+        } \
+        p->slab = next; \
+        p->used = 0; \
+    } \
+    T *item = &p->slab->items[p->used++]; \
+    memset(item, 0, sizeof(T)); \
+    return item; \
+} \
+static inline void N##_pool_release(N##_pool *p) { \
+    p->slab = NULL; \
+    p->used = POOL_SLAB; \
+} \
+
+#endif
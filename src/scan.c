@@ -0,0 +1,198 @@
+#include <stdbool.h>
+#include <string.h>
+#include "scan.h"
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+static inline bool is_space(unsigned char c) {
+    return c == ' ' || (unsigned char)(c - '\t') <= '\r' - '\t';
+}
+
+static inline bool is_ident(unsigned char c) {
+    return (unsigned char)((c | 0x20) - 'a') <= 'z' - 'a' || c == '_';
+}
+
+static inline bool is_digit(unsigned char c) {
+    return (unsigned char)(c - '0') <= 9;
+}
+
+static inline bool is_string_stop(unsigned char c) {
+    return c == '"' || c == '\\';
+}
+
+#define SCALAR_RUN(name, pred) \
+static size_t name##_scalar(const char *p, size_t n) { \
+    size_t i = 0; \
+    while (i < n && pred((unsigned char)p[i])) i++; \
+    return i; \
+}
+
+#define SCALAR_UNTIL(name, pred) \
+static size_t name##_scalar(const char *p, size_t n) { \
+    size_t i = 0; \
+    while (i < n && !pred((unsigned char)p[i])) i++; \
+    return i; \
+}
+
+SCALAR_RUN(whitespace, is_space)
+SCALAR_RUN(ident, is_ident)
+SCALAR_RUN(digits, is_digit)
+SCALAR_UNTIL(string, is_string_stop)
+
+// glibc's memchr is already vectorised, so comment bodies use it at every level
+static size_t line_any(const char *p, size_t n) {
+    const char *nl = memchr(p, '\n', n);
+    return nl ? (size_t)(nl - p) : n;
+}
+
+#ifdef SCAN_X86
+
+// Each classifier returns 0xFF in every lane whose byte is in the class.
+// Unsigned range checks use min(x - lo, hi - lo) == x - lo.
+
+#define SSE2_IN_RANGE(v, lo, hi) ({ \
+    __m128i t_ = _mm_sub_epi8((v), _mm_set1_epi8(lo)); \
+    _mm_cmpeq_epi8(_mm_min_epu8(t_, _mm_set1_epi8((hi) - (lo))), t_); \
+})
+
+static inline __m128i class_space_sse2(__m128i v) {
+    return _mm_or_si128(SSE2_IN_RANGE(v, '\t', '\r'), _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+}
+
+static inline __m128i class_ident_sse2(__m128i v) {
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    return _mm_or_si128(SSE2_IN_RANGE(lower, 'a', 'z'), _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+}
+
+static inline __m128i class_digits_sse2(__m128i v) {
+    return SSE2_IN_RANGE(v, '0', '9');
+}
+
+static inline __m128i class_string_sse2(__m128i v) {
+    return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+}
+
+// The last vector may run up to SCAN_OVERREAD bytes past n; anything it
+// finds there is clamped away
+#define SCAN_CLAMP(i, n) ((i) < (n) ? (i) : (n))
+
+#define SSE2_SCAN(name, classify, invert) \
+static size_t name##_sse2(const char *p, size_t n) { \
+    for (size_t i = 0; i < n; i += 16) { \
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i)); \
+        unsigned mask = (unsigned)_mm_movemask_epi8(classify(v)); \
+        if (invert) mask = ~mask & 0xFFFF; \
+        if (mask) return SCAN_CLAMP(i + __builtin_ctz(mask), n); \
+    } \
+    return n; \
+}
+
+SSE2_SCAN(whitespace, class_space_sse2, true)
+SSE2_SCAN(ident, class_ident_sse2, true)
+SSE2_SCAN(digits, class_digits_sse2, true)
+SSE2_SCAN(string, class_string_sse2, false)
+
+#define AVX2 __attribute__((target("avx2")))
+
+#define AVX2_IN_RANGE(v, lo, hi) ({ \
+    __m256i t_ = _mm256_sub_epi8((v), _mm256_set1_epi8(lo)); \
+    _mm256_cmpeq_epi8(_mm256_min_epu8(t_, _mm256_set1_epi8((hi) - (lo))), t_); \
+})
+
+AVX2 static inline __m256i class_space_avx2(__m256i v) {
+    return _mm256_or_si256(AVX2_IN_RANGE(v, '\t', '\r'), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+}
+
+AVX2 static inline __m256i class_ident_avx2(__m256i v) {
+    __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    return _mm256_or_si256(AVX2_IN_RANGE(lower, 'a', 'z'), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+}
+
+AVX2 static inline __m256i class_digits_avx2(__m256i v) {
+    return AVX2_IN_RANGE(v, '0', '9');
+}
+
+AVX2 static inline __m256i class_string_avx2(__m256i v) {
+    return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+}
+
+#define AVX2_SCAN(name, classify, invert) \
+AVX2 static size_t name##_avx2(const char *p, size_t n) { \
+    for (size_t i = 0; i < n; i += 32) { \
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i)); \
+        unsigned mask = (unsigned)_mm256_movemask_epi8(classify(v)); \
+        if (invert) mask = ~mask; \
+        if (mask) return SCAN_CLAMP(i + __builtin_ctz(mask), n); \
+    } \
+    return n; \
+}
+
+AVX2_SCAN(whitespace, class_space_avx2, true)
+AVX2_SCAN(ident, class_ident_avx2, true)
+AVX2_SCAN(digits, class_digits_avx2, true)
+AVX2_SCAN(string, class_string_avx2, false)
+
+#endif
+
+// Scalar until scan_use() says otherwise. Runs in real code are a few bytes
+// long, and on lex_bench the vector kernels' setup costs more than their
+// width saves, so they are opt-in.
+ScanFn scan_whitespace = whitespace_scalar;
+ScanFn scan_ident = ident_scalar;
+ScanFn scan_digits = digits_scalar;
+ScanFn scan_line = line_any;
+ScanFn scan_string = string_scalar;
+
+static ScanLevel cpu_level(void) {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SCAN_AVX2;
+    if (__builtin_cpu_supports("sse2")) return SCAN_SSE2;
+#endif
+    return SCAN_SCALAR;
+}
+
+ScanLevel scan_use(ScanLevel max) {
+    ScanLevel level = cpu_level();
+    if (level > max) level = max;
+
+    switch (level) {
+#ifdef SCAN_X86
+        case SCAN_AVX2: {
+            scan_whitespace = whitespace_avx2;
+            scan_ident = ident_avx2;
+            scan_digits = digits_avx2;
+            scan_string = string_avx2;
+            break;
+        }
+        case SCAN_SSE2: {
+            scan_whitespace = whitespace_sse2;
+            scan_ident = ident_sse2;
+            scan_digits = digits_sse2;
+            scan_string = string_sse2;
+            break;
+        }
+#endif
+        default: {
+            level = SCAN_SCALAR;
+            scan_whitespace = whitespace_scalar;
+            scan_ident = ident_scalar;
+            scan_digits = digits_scalar;
+            scan_string = string_scalar;
+            break;
+        }
+    }
+
+    return level;
+}
+
+const char *scan_level_name(ScanLevel level) {
+    switch (level) {
+        case SCAN_AVX2: return "avx2";
+        case SCAN_SSE2: return "sse2";
+        default: return "scalar";
+    }
+}
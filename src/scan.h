@@ -0,0 +1,33 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+// Bulk character-class scanners for the lexer. Each returns the number of
+// leading bytes of p[0..n) that belong to the run (or precede the stop byte),
+// so the result is n when the whole range matched.
+//
+// The vector kernels load whole blocks and may read up to SCAN_OVERREAD bytes
+// past p + n, so the buffer must be padded (see SOURCE_PADDING).
+#define SCAN_OVERREAD 32
+typedef size_t (*ScanFn)(const char *p, size_t n);
+
+typedef enum {
+    SCAN_SCALAR,
+    SCAN_SSE2,
+    SCAN_AVX2,
+} ScanLevel;
+
+extern ScanFn scan_whitespace;  // ' ', \t, \n, \v, \f, \r
+extern ScanFn scan_ident;       // [A-Za-z_]
+extern ScanFn scan_digits;      // [0-9]
+extern ScanFn scan_line;        // up to '\n'
+extern ScanFn scan_string;      // up to '"' or '\\'
+
+// The scalar scanners are the default. Picks the widest implementation the
+// CPU supports, capped at max, and returns the level actually selected.
+// Not thread-safe: call it before any lexing starts.
+ScanLevel scan_use(ScanLevel max);
+const char *scan_level_name(ScanLevel level);
+
+#endif
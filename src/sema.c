@@ -1,7 +1,7 @@
 #include "sema.h"
 #include "error.h"
 
-Symbol *declare_symbol(Analyser *ctx, String name, uint32_t flags);
+Symbol *declare_symbol(Analyser *ctx, Atom name, uint32_t flags);
 void register_globals(Analyser *ctx, Module *mod);
 void resolve_types(Analyser *ctx, Module *mod);
 void check_bodies(Analyser *ctx, Module *mod);
@@ -9,20 +9,10 @@ TypeRef *check_expr(Analyser *ctx, Expr *expr);
 bool types_equal(TypeRef *a, TypeRef *b);
 
 static void inject_builtin_types(Analyser *ctx) {
-    char* builtins[] = {
-        "int", "int8", "int16", "int32", "int64",
-        "uint", "uint8", "uint16", "uint32", "uint64",
-        "char", "string",
-        "bool",
-        "none"
-    };
+    for (Atom type_name = ATOM_INT; type_name < ATOM_BUILTIN_COUNT; type_name++) {
+        Symbol *sym = declare_symbol(ctx, type_name, SYMFLAG_TYPE);
 
-    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
-        char *type_name = builtins[i];
-
-        Symbol *sym = declare_symbol(ctx, string_make(type_name), SYMFLAG_TYPE);
-
-        TypeRef *type_ref = arena_calloc(ctx->arena, sizeof(TypeRef));
+        TypeRef *type_ref = arena_new(ctx->arena, TypeRef);
         type_ref->type = TYPEREF_NAMED;
         type_ref->is_mutable = false;
         type_ref->type_symbol = sym;
@@ -30,9 +20,9 @@ static void inject_builtin_types(Analyser *ctx) {
     }
 }
 
-Scope *scope_init(Arena *a) {
-    Scope *s = arena_alloc(a, sizeof(Scope));
-    s->symbols = syms_array_init();
+// The symbol table grows in `tables`, which may be shorter-lived than the scope
+Scope *scope_init(Scope *s, Arena *tables) {
+    s->symbols = syms_array_init_in(tables);
     s->parent = NULL;
     return s;
 }
@@ -40,8 +30,10 @@ Scope *scope_init(Arena *a) {
 Analyser analyser_init(Module *m, Arena *a) {
     Analyser an;
     an.arena = a;
+    an.scratch = arena_scratch();
+    an.scopes = scope_pool_init(a);
     an.current_function = NULL;
-    an.global_scope = scope_init(a);
+    an.global_scope = scope_init(arena_new(a, Scope), a);
     an.current_scope = an.global_scope;
     an.module = m;
 
@@ -63,27 +55,31 @@ void enter_scope(Analyser *ctx, Scope *existing) {
         existing->parent = ctx->current_scope;
         ctx->current_scope = existing;
     } else {
-        Scope *new_scope = scope_init(ctx->arena);
+        Scope *new_scope = scope_init(scope_pool_new(&ctx->scopes), ctx->scratch);
         new_scope->parent = ctx->current_scope;
         ctx->current_scope = new_scope;
     }
 }
 
+// Nothing looks a name up in a scope once it is left, so a local scope's
+// table is dropped along with the scratch memory it lives in
 void leave_scope(Analyser *ctx) {
     if (ctx->current_scope && ctx->current_scope->parent) {
+        syms_array_free(&ctx->current_scope->symbols);
         ctx->current_scope = ctx->current_scope->parent;
     }
 }
 
-Symbol *declare_symbol(Analyser *ctx, String name, uint32_t flags) {
+Symbol *declare_symbol(Analyser *ctx, Atom name, uint32_t flags) {
     for (size_t i = 0; i < ctx->current_scope->symbols.len; i++) {
         Symbol *sym = ctx->current_scope->symbols.data[i];
-        if (string_eq(sym->name, name)) {
-            error(sym->token, format("Redeclaration of symbol %.*s", sym->name.length, sym->name.data));
+        if (sym->name == name) {
+            String text = atom_string(name);
+            error(sym->token, format("Redeclaration of symbol %.*s", (int)text.length, text.data));
         }
     }
 
-    Symbol *sym = arena_calloc(ctx->arena, sizeof(Symbol));
+    Symbol *sym = arena_new(ctx->arena, Symbol);
     sym->name = name;
     sym->flags = flags;
     sym->defined_in = ctx->current_scope;
@@ -92,13 +88,13 @@ Symbol *declare_symbol(Analyser *ctx, String name, uint32_t flags) {
     return sym;
 }
 
-Symbol *lookup_symbol(Analyser *ctx, String name) {
+Symbol *lookup_symbol(Analyser *ctx, Atom name) {
     Scope *scope = ctx->current_scope;
 
     while (scope != NULL) {
         for (size_t i = 0; i < scope->symbols.len; i++) {
             Symbol *sym = scope->symbols.data[i];
-            if (string_eq(sym->name, name)) {
+            if (sym->name == name) {
                 return sym;
             }
         }
@@ -142,6 +138,8 @@ void register_globals(Analyser *ctx, Module *mod) {
             case DECL_VAR: {
                 error(d->token, "Global variables are not allowed");
             }
+            // Modules with syntax errors never reach sema
+            case DECL_ERROR: break;
         }
     }
 }
@@ -183,22 +181,14 @@ static size_t get_type_size(TypeRef *type) {
             Symbol *sym = type->type_symbol;
             if (!sym) return 0;
 
-            if (string_eq(sym->name, string_make("int8")) || string_eq(sym->name, string_make("uint8")) 
-             || string_eq(sym->name, string_make("bool")) || string_eq(sym->name, string_make("char")) ) {
-                return 1;
-            }
-            if (string_eq(sym->name, string_make("int16")) || string_eq(sym->name, string_make("uint16")) ) {
-                return 2;
-            }
-            if (string_eq(sym->name, string_make("int32")) || string_eq(sym->name, string_make("uint32")) ) {
-                return 4;
-            }
-            if (string_eq(sym->name, string_make("int64")) || string_eq(sym->name, string_make("uint64")) 
-             || string_eq(sym->name, string_make("int")) || string_eq(sym->name, string_make("uint")) ) {
-                return 8;
-            }
-            if (string_eq(sym->name, string_make("string")) ) {
-                return 16;  // ptr + len
+            switch (sym->name) {
+                case ATOM_INT8: case ATOM_UINT8: case ATOM_BOOL: case ATOM_CHAR: return 1;
+                case ATOM_INT16: case ATOM_UINT16: return 2;
+                case ATOM_INT32: case ATOM_UINT32: return 4;
+                case ATOM_INT64: case ATOM_UINT64: case ATOM_INT: case ATOM_UINT: return 8;
+                case ATOM_FLOAT: return 8;
+                case ATOM_STRING: return 16;    // ptr + len
+                default: break;
             }
 
             if (sym->decl->type == DECL_STRUCT) {
@@ -210,9 +200,9 @@ static size_t get_type_size(TypeRef *type) {
 
             return 0;
         }
-
-        return 0;
     }
+
+    return 0;
 }
 
 static size_t get_type_align(TypeRef *type) {
@@ -229,23 +219,16 @@ static size_t get_type_align(TypeRef *type) {
             Symbol *sym = type->type_symbol;
             if (!sym) return 1;
 
-            if (string_eq(sym->name, string_make("int8")) || string_eq(sym->name, string_make("uint8")) 
-             || string_eq(sym->name, string_make("bool")) || string_eq(sym->name, string_make("char")) ) {
-                return 1;
-            }
-            if (string_eq(sym->name, string_make("int16")) || string_eq(sym->name, string_make("uint16")) ) {
-                return 2;
-            }
-            if (string_eq(sym->name, string_make("int32")) || string_eq(sym->name, string_make("uint32")) ) {
-                return 4;
-            }
-            if (string_eq(sym->name, string_make("int64")) || string_eq(sym->name, string_make("uint64")) 
-             || string_eq(sym->name, string_make("int")) || string_eq(sym->name, string_make("uint")) ) {
-                return 8;
-            }
-            if (string_eq(sym->name, string_make("string")) ) {
-                return 8;   // ptr + len
+            switch (sym->name) {
+                case ATOM_INT8: case ATOM_UINT8: case ATOM_BOOL: case ATOM_CHAR: return 1;
+                case ATOM_INT16: case ATOM_UINT16: return 2;
+                case ATOM_INT32: case ATOM_UINT32: return 4;
+                case ATOM_INT64: case ATOM_UINT64: case ATOM_INT: case ATOM_UINT: return 8;
+                case ATOM_FLOAT: return 8;
+                case ATOM_STRING: return 8;     // ptr + len
+                default: break;
             }
+
             if (sym->decl->type == DECL_STRUCT) {
                 return sym->decl->_struct->align;
             }
@@ -255,15 +238,17 @@ static size_t get_type_align(TypeRef *type) {
 
             return 1;
         }
-        
-        return 1;
     }
+
+    return 1;
 }
 
-static void calculate_struct_layout(StructDecl *str) {
+static void calculate_struct_layout(Analyser *ctx, StructDecl *str) {
     size_t offset = 0;
     size_t max_align = 1;
 
+    str->field_offsets = size_array_init_in(ctx->arena);
+
     for (size_t i = 0; i < str->members.len; i++) {
         VarDecl *member = str->members.data[i];
         size_t member_size = get_type_size(member->type);
@@ -278,7 +263,7 @@ static void calculate_struct_layout(StructDecl *str) {
             offset += member_align - (offset % member_align);
         }
 
-        str->field_offsets.data[i] = offset;
+        size_array_push(&str->field_offsets, offset);
         offset += member_size;
     }
 
@@ -339,7 +324,7 @@ void resolve_types(Analyser *ctx, Module *mod) {
                     resolve_typeref(ctx, m->type);
                 }
 
-                calculate_struct_layout(d->_struct);
+                calculate_struct_layout(ctx, d->_struct);
                 break;
             }
             case DECL_UNION: {
@@ -349,10 +334,13 @@ void resolve_types(Analyser *ctx, Module *mod) {
                 }
 
                 calculate_union_layout(d->_union);
+                break;
             }
             case DECL_VAR: {
                 error(d->token, "Global variables are not allowed");
             }
+            // Modules with syntax errors never reach sema
+            case DECL_ERROR: break;
         }
     }
 }
@@ -372,6 +360,15 @@ void check_stmt(Analyser *ctx, Stmt *stmt) {
             leave_scope(ctx);
             break;
         }
+        case STMT_UNSAFE: {
+            enter_scope(ctx, NULL);
+            for (size_t i = 0; i < stmt->unsafe.stmts.len; i++) {
+                Stmt *s = stmt->unsafe.stmts.data[i];
+                check_stmt(ctx, s);
+            }
+            leave_scope(ctx);
+            break;
+        }
         case STMT_VAR: {
             VarDecl *var = stmt->var;
             resolve_typeref(ctx, var->type);
@@ -400,7 +397,7 @@ void check_stmt(Analyser *ctx, Stmt *stmt) {
                 }
             } else {
                 if (ctx->current_function->ret_type
-                 && !string_eq(ctx->current_function->ret_type->type_symbol->name, string_make("none"))) {
+                 && ctx->current_function->ret_type->type_symbol->name != ATOM_NONE) {
                     error(stmt->token, "Function expects a return value");
                  }
             }
@@ -413,7 +410,7 @@ void check_stmt(Analyser *ctx, Stmt *stmt) {
         case STMT_IF: {
             if (stmt->_if.cond) {
                 TypeRef *cond_type = check_expr(ctx, stmt->_if.cond);
-                if (!cond_type || !string_eq(cond_type->type_symbol->name, string_make("bool"))) {
+                if (!cond_type || cond_type->type_symbol->name != ATOM_BOOL) {
                     error(stmt->token, "Condition must be of boolean type");
                 }
             }
@@ -427,7 +424,7 @@ void check_stmt(Analyser *ctx, Stmt *stmt) {
         case STMT_WHILE: {
             if (stmt->_while.cond) {
                 TypeRef *cond_type = check_expr(ctx, stmt->_while.cond);
-                if (!cond_type || !string_eq(cond_type->type_symbol->name, string_make("bool"))) {
+                if (!cond_type || cond_type->type_symbol->name != ATOM_BOOL) {
                     error(stmt->token, "Condition must be of boolean type");
                 }
             }
@@ -444,7 +441,7 @@ void check_stmt(Analyser *ctx, Stmt *stmt) {
 
             if (stmt->_for.cond) {
                 TypeRef *cond_type = check_expr(ctx, stmt->_for.cond);
-                if (!cond_type || !string_eq(cond_type->type_symbol->name, string_make("bool"))) {
+                if (!cond_type || cond_type->type_symbol->name != ATOM_BOOL) {
                     error(stmt->token, "Condition must be of boolean type");
                 }
             }
@@ -461,13 +458,15 @@ void check_stmt(Analyser *ctx, Stmt *stmt) {
 
             break;
         }
+        case STMT_ERROR: break;
     }
 }
 
 void check_fn_body(Analyser *ctx, FnDecl *fn) {
-    if (!fn->body) return;
+    if (!parse_fn_body(fn)) return;
 
     ctx->current_function = fn;
+    ArenaMark mark = arena_mark(ctx->scratch);
 
     enter_scope(ctx, NULL);
     fn->local_scope = ctx->current_scope;
@@ -482,6 +481,9 @@ void check_fn_body(Analyser *ctx, FnDecl *fn) {
     check_stmt(ctx, fn->body);
 
     leave_scope(ctx);
+    arena_reset_to(ctx->scratch, mark);
+    scope_pool_release(&ctx->scopes);
+    fn->local_scope = NULL;
     ctx->current_function = NULL;
 }
 
@@ -496,21 +498,29 @@ void check_bodies(Analyser *ctx, Module *mod) {
     }
 }
 
+static TypeRef *pointer_to(Analyser *ctx, TypeRef *pointee) {
+    if (!pointee->pointer_type) {
+        TypeRef *p = arena_new(ctx->arena, TypeRef);
+        p->type = TYPEREF_POINTER;
+        p->pointer.pointee = pointee;
+        p->is_mutable = false;
+        pointee->pointer_type = p;
+    }
+    return pointee->pointer_type;
+}
+
 static bool is_integer_type(TypeRef *type) {
     if (!type || type->type != TYPEREF_NAMED) return false;
     Symbol *sym = type->type_symbol;
     if (!sym) return false;
 
-    return string_eq(sym->name, string_make("int"))   ||
-           string_eq(sym->name, string_make("int8"))  ||
-           string_eq(sym->name, string_make("int16")) ||
-           string_eq(sym->name, string_make("int32")) ||
-           string_eq(sym->name, string_make("int64")) ||
-           string_eq(sym->name, string_make("uint"))  ||
-           string_eq(sym->name, string_make("uint8")) ||
-           string_eq(sym->name, string_make("uint16"))||
-           string_eq(sym->name, string_make("uint32"))||
-           string_eq(sym->name, string_make("uint64"));
+    switch (sym->name) {
+        case ATOM_INT: case ATOM_INT8: case ATOM_INT16: case ATOM_INT32: case ATOM_INT64:
+        case ATOM_UINT: case ATOM_UINT8: case ATOM_UINT16: case ATOM_UINT32: case ATOM_UINT64:
+            return true;
+        default:
+            return false;
+    }
 }
 
 TypeRef *check_expr(Analyser *ctx, Expr *expr) {
@@ -519,12 +529,13 @@ TypeRef *check_expr(Analyser *ctx, Expr *expr) {
     TypeRef *result_type = NULL;
     switch (expr->type) {
         case EXPR_LIT: {
-            String type_name;
+            Atom type_name = ATOM_EMPTY;
             switch (expr->literal.type) {
-                case LITERAL_INT: type_name = string_make("int"); break;
-                case LITERAL_BOOL: type_name = string_make("bool"); break;
-                case LITERAL_STRING: type_name = string_make("string"); break;
-                case LITERAL_CHAR: type_name = string_make("char"); break;
+                case LITERAL_INT: type_name = ATOM_INT; break;
+                case LITERAL_FLOAT: type_name = ATOM_FLOAT; break;
+                case LITERAL_BOOL: type_name = ATOM_BOOL; break;
+                case LITERAL_STRING: type_name = ATOM_STRING; break;
+                case LITERAL_CHAR: type_name = ATOM_CHAR; break;
             }
             Symbol *type_sym = lookup_symbol(ctx, type_name);
             result_type = type_sym ? type_sym->type : NULL;
@@ -554,7 +565,7 @@ TypeRef *check_expr(Analyser *ctx, Expr *expr) {
                 expr->binary.op == BINOP_GT || 
                 expr->binary.op == BINOP_GE || 
                 expr->binary.op == BINOP_NE) {
-                result_type = lookup_symbol(ctx, string_make("bool"))->type;
+                result_type = lookup_symbol(ctx, ATOM_BOOL)->type;
                 goto check_expr_finished;
             }
 
@@ -596,7 +607,7 @@ TypeRef *check_expr(Analyser *ctx, Expr *expr) {
             }
 
             for (size_t i = 0; i < expr->call.args.len; i++) {
-                TypeRef *arg_type = check_expr(ctx, expr->call.args.data[i]);
+                TypeRef *arg_type = check_expr(ctx, exprs_array_data(&expr->call.args)[i]);
                 TypeRef *param_type = fn->params.data[i].type;
 
                 if (!types_equal(arg_type, param_type)) {
@@ -631,7 +642,7 @@ TypeRef *check_expr(Analyser *ctx, Expr *expr) {
 
             vardecls_array members = str ? str->members : unn->members;
             for (size_t i = 0; i < members.len; i++) {
-                if (string_eq(members.data[i]->name, expr->member.member)) {
+                if (members.data[i]->name == expr->member.member) {
                     result_type = members.data[i]->type;
                     goto check_expr_finished;
                 }
@@ -645,7 +656,6 @@ TypeRef *check_expr(Analyser *ctx, Expr *expr) {
 
             switch (expr->unary.op) {
                 case UOP_NEG: {
-                    String name = operand_type->type_symbol->name;
                     if (!is_integer_type(operand_type)) {
                         error(operand_type->token, "Can only negate integers");
                     }
@@ -653,18 +663,14 @@ TypeRef *check_expr(Analyser *ctx, Expr *expr) {
                     goto check_expr_finished;
                 }
                 case UOP_NOT: {
-                    if (!string_eq(operand_type->type_symbol->name, string_make("bool"))) {
+                    if (operand_type->type_symbol->name != ATOM_BOOL) {
                         error(operand_type->token, "Can only '!' booleans");
                     }
                     result_type = operand_type;
                     goto check_expr_finished;
                 }
                 case UOP_ADDR: {
-                    TypeRef *p = arena_calloc(ctx->arena, sizeof(TypeRef));
-                    p->type = TYPEREF_POINTER;
-                    p->pointer.pointee = operand_type;
-                    p->is_mutable = false;
-                    result_type = p;
+                    result_type = pointer_to(ctx, operand_type);
                     goto check_expr_finished;
                 }
                 case UOP_DEREF: {
@@ -676,6 +682,7 @@ TypeRef *check_expr(Analyser *ctx, Expr *expr) {
                     error(operand_type->token, "Cannot dereference non-pointer");
                 }
             }
+            break;
         }
         case EXPR_INDEX: {
             TypeRef *base_type = check_expr(ctx, expr->index.base);
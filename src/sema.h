@@ -3,6 +3,9 @@
 
 #include "ast.h"
 #include "arena.h"
+#include "pool.h"
+
+INSTANTIATE(Scope, scope, POOL_TEMPLATE)
 
 typedef struct {
     Module *module;
@@ -12,6 +15,9 @@ typedef struct {
     FnDecl *current_function;
 
     Arena *arena;
+    Arena *scratch;     // local symbol tables, reset after each function
+
+    scope_pool scopes;  // local scopes, recycled after each function
 } Analyser;
 
 Analyser analyser_init(Module *m, Arena *a);
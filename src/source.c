@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "source.h"
+
+static bool map_file(Source *source, int fd, size_t size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t total = (size + SOURCE_PADDING + page - 1) & ~(page - 1);
+
+    // Reserve zeroed pages for the file plus padding, then map the file over
+    // the front of them. The tail of the last file page is zero-filled too.
+    char *base = mmap(NULL, total, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) return false;
+
+    if (size > 0) {
+        if (mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            munmap(base, total);
+            return false;
+        }
+        madvise(base, size, MADV_SEQUENTIAL);
+    }
+
+    source->contents = (String){ .data = base, .length = size };
+    source->mapping = total;
+    return true;
+}
+
+static bool read_stream(Source *source, FILE *f) {
+    size_t cap = 64 * 1024;
+    size_t len = 0;
+    char *data = malloc(cap + SOURCE_PADDING);
+    if (!data) return false;
+
+    size_t n;
+    while ((n = fread(data + len, 1, cap - len, f)) > 0) {
+        len += n;
+        if (len == cap) {
+            cap *= 2;
+            char *grown = realloc(data, cap + SOURCE_PADDING);
+            if (!grown) {
+                free(data);
+                return false;
+            }
+            data = grown;
+        }
+    }
+
+    if (ferror(f)) {
+        free(data);
+        return false;
+    }
+
+    memset(data + len, 0, SOURCE_PADDING);
+    source->contents = (String){ .data = data, .length = len };
+    source->mapping = 0;
+    source->capacity = cap;
+    return true;
+}
+
+Source source_load(char *path) {
+    bool is_stdin = strcmp(path, "-") == 0;
+
+    Source source = {0};
+    source.path = string_make(is_stdin ? "<stdin>" : path);
+
+    FILE *f = is_stdin ? stdin : fopen(path, "rb");
+    if (!f) {
+        perror("Failed to open file");
+        exit(1);
+    }
+
+    struct stat st;
+    bool loaded = false;
+    if (fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode)) {
+        loaded = map_file(&source, fileno(f), st.st_size);
+    }
+    if (!loaded) {
+        loaded = read_stream(&source, f);
+    }
+    if (!loaded) {
+        perror("Failed to read file");
+        exit(1);
+    }
+
+    if (!is_stdin) fclose(f);
+    return source;
+}
+
+Source source_edit(Source *source, size_t start, size_t end, String text) {
+    String old = source->contents;
+    if (start > end || end > old.length) {
+        fprintf(stderr, "source_edit: range %zu..%zu outside of %zu bytes\n", start, end, old.length);
+        exit(1);
+    }
+
+    size_t length = old.length - (end - start) + text.length;
+    char *data = malloc(length + SOURCE_PADDING);
+    if (!data) {
+        fprintf(stderr, "source_edit: malloc failed\n");
+        exit(1);
+    }
+
+    memcpy(data, old.data, start);
+    if (text.length) memcpy(data + start, text.data, text.length);
+    memcpy(data + start + text.length, old.data + end, old.length - end);
+    memset(data + length, 0, SOURCE_PADDING);
+
+    return (Source){
+        .path = source->path,
+        .contents = { .data = data, .length = length },
+        .capacity = length,
+    };
+}
+
+void source_replace(Source *source, size_t start, size_t end, String text) {
+    if (source->mapping) {
+        Source copy = source_edit(source, start, end, text);
+        source_close(source);
+        *source = copy;
+        return;
+    }
+
+    String old = source->contents;
+    if (start > end || end > old.length) {
+        fprintf(stderr, "source_replace: range %zu..%zu outside of %zu bytes\n", start, end, old.length);
+        exit(1);
+    }
+
+    size_t length = old.length - (end - start) + text.length;
+    if (length > source->capacity) {
+        size_t cap = length + length / 2;
+        char *data = realloc(old.data, cap + SOURCE_PADDING);
+        if (!data) {
+            fprintf(stderr, "source_replace: realloc failed\n");
+            exit(1);
+        }
+        source->contents.data = data;
+        source->capacity = cap;
+    }
+
+    char *data = source->contents.data;
+    memmove(data + start + text.length, data + end, old.length - end);
+    if (text.length) memcpy(data + start, text.data, text.length);
+    memset(data + length, 0, SOURCE_PADDING);
+    source->contents.length = length;
+
+    if (source->line_starts.alive) {
+        size_array_free(&source->line_starts);
+        source->line_starts = (size_array){0};
+    }
+}
+
+void source_close(Source *source) {
+    if (source->mapping) {
+        munmap(source->contents.data, source->mapping);
+    } else {
+        free(source->contents.data);
+    }
+    if (source->line_starts.alive) {
+        size_array_free(&source->line_starts);
+    }
+    source->contents = (String){0};
+    source->mapping = 0;
+}
+
+static void index_lines(Source *source) {
+    source->line_starts = size_array_init();
+    size_array_push(&source->line_starts, 0);
+
+    char *data = source->contents.data;
+    char *end = data + source->contents.length;
+    char *nl;
+    while ((nl = memchr(data, '\n', end - data))) {
+        data = nl + 1;
+        size_array_push(&source->line_starts, data - source->contents.data);
+    }
+}
+
+Position source_position(Source *source, size_t offset) {
+    if (!source->line_starts.alive) {
+        index_lines(source);
+    }
+
+    // last line starting at or before offset
+    size_t lo = 0, hi = source->line_starts.len;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (source->line_starts.data[mid] <= offset) lo = mid;
+        else hi = mid;
+    }
+
+    return (Position){
+        .line = lo + 1,
+        .col = offset - source->line_starts.data[lo] + 1,
+    };
+}
+
+String source_line(Source *source, size_t line) {
+    if (!source->line_starts.alive) {
+        index_lines(source);
+    }
+    if (line == 0 || line > source->line_starts.len) {
+        return (String){ .data = source->contents.data, .length = 0 };
+    }
+
+    size_t start = source->line_starts.data[line - 1];
+    size_t end = line < source->line_starts.len
+        ? source->line_starts.data[line] - 1
+        : source->contents.length;
+
+    return (String){ .data = source->contents.data + start, .length = end - start };
+}
@@ -0,0 +1,44 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stddef.h>
+#include "array.h"
+#include "string.h"
+
+INSTANTIATE(size_t, size, ARRAY_TEMPLATE)
+
+// Loaded contents are always followed by this many zero bytes, so scanners
+// can read whole vectors past the end without bounds checks
+#define SOURCE_PADDING 64
+
+typedef struct {
+    String path;
+    String contents;
+    size_t index;
+
+    size_array line_starts;     // built on first source_position() call
+    size_t mapping;             // bytes mmap'd, 0 if contents is on the heap
+    size_t capacity;            // heap bytes before the padding, 0 if just length
+} Source;
+
+// 1-based, as printed in diagnostics
+typedef struct {
+    size_t line, col;
+} Position;
+
+// Maps regular files read-only; pipes and "-" (stdin) are read into a buffer.
+// Exits on failure.
+Source source_load(char *path);
+void source_close(Source *source);
+
+// Returns a copy of source with bytes [start, end) replaced by text, in a new
+// padded heap buffer. The original is left untouched for the caller to close.
+Source source_edit(Source *source, size_t start, size_t end, String text);
+// The same edit in place: only the bytes after `end` move, and the heap
+// buffer grows with room to spare. A mapped file is copied to the heap first.
+void source_replace(Source *source, size_t start, size_t end, String text);
+
+Position source_position(Source *source, size_t offset);
+String source_line(Source *source, size_t line);
+
+#endif
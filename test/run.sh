@@ -0,0 +1,22 @@
+#!/bin/sh
+# Runs coda on each test/recover_*.coda and compares what it prints (colours
+# stripped) and its exit status with the matching .expected file. With
+# UPDATE=1 the .expected files are rewritten instead.
+cd "$(dirname "$0")/.." || exit 1
+
+failed=0
+for src in test/recover_*.coda; do
+    expected="${src%.coda}.expected"
+    actual=$(timeout 10 ./coda "$src" 2>&1; echo "exit $?")
+    actual=$(printf '%s\n' "$actual" | sed 's/\x1b\[[0-9;]*m//g')
+
+    if [ "$UPDATE" = 1 ]; then
+        printf '%s\n' "$actual" > "$expected"
+    elif ! printf '%s\n' "$actual" | diff -u "$expected" - ; then
+        echo "FAIL $src"
+        failed=1
+    fi
+done
+
+[ $failed = 0 ] && echo "recovery tests passed"
+exit $failed